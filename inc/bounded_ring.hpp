@@ -0,0 +1,251 @@
+#pragma once
+
+#include <atomic>
+#include <concepts.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <stats.hpp>
+#include <storage.hpp>
+#include <type_traits>
+#include <utility>
+
+namespace wait_free_bag
+{
+        // Ref: https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+        // Bounded MPMC ring with a sequence number per cell. All cells are allocated by the constructor and elements live inline in their
+        // cell, so enqueue and dequeue never allocate. enqueue fails once the ring is full. A cell only becomes visible to dequeuers when
+        // its enqueuer publishes the sequence number, so a stalled enqueuer holds up the dequeuers of that one cell.
+        template<typename DataType, std::size_t Capacity = 1024>
+        class BoundedRing
+        {
+                private:
+                        static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+                        static constexpr std::size_t mask = Capacity - 1;
+
+                        // A cell with sequence position is free for the enqueuer of position, with sequence position + 1 it holds the element
+                        // for the dequeuer of position
+                        struct cell_t
+                        {
+                                public:
+                                        std::atomic_size_t  sequence = 0;
+                                        storage_t<DataType> data;
+                        };
+
+                        const std::unique_ptr<cell_t[]> cells;
+                        alignas(64) std::atomic_size_t  enqueue_position = 0;
+                        alignas(64) std::atomic_size_t  dequeue_position = 0;
+                        alignas(64) ShardEvents         events;
+
+                        static std::ptrdiff_t distance(const std::size_t sequence, const std::size_t position)
+                        {
+                                return static_cast<std::ptrdiff_t>(sequence - position);
+                        }
+
+                        // enqueue_position moves before the element is constructed, the cell only holds it once its sequence says so
+                        static bool published(const cell_t& cell, const std::size_t position)
+                        {
+                                return cell.sequence.load(std::memory_order_acquire) == position + 1;
+                        }
+
+                        // Visits the published cells in [dequeue_position, enqueue_position), cells whose enqueuer has claimed them but not
+                        // published its element yet are skipped
+                        template<bool Const>
+                        class basic_iterator_t
+                        {
+                                private:
+                                        cell_t*     cells    = nullptr;
+                                        std::size_t position = 0;
+                                        std::size_t stop     = 0;
+
+                                        void settle()
+                                        {
+                                                while(position != stop && !published(cells[position & mask], position)) position++;
+                                                if(position == stop)
+                                                {
+                                                        cells    = nullptr;
+                                                        position = stop = 0;
+                                                }
+                                        }
+
+                                public:
+                                        using iterator_concept  = std::forward_iterator_tag;
+                                        using iterator_category = std::forward_iterator_tag;
+                                        using value_type        = DataType;
+                                        using difference_type   = std::ptrdiff_t;
+                                        using reference         = std::conditional_t<Const, const DataType&, DataType&>;
+                                        using pointer           = std::conditional_t<Const, const DataType*, DataType*>;
+
+                                        basic_iterator_t() = default;
+
+                                        basic_iterator_t(cell_t* const cells, const std::size_t position, const std::size_t stop): cells(cells), position(position), stop(stop)
+                                        {
+                                                settle();
+                                        }
+
+                                        reference operator*() const
+                                        {
+                                                return cells[position & mask].data.get();
+                                        }
+
+                                        pointer operator->() const
+                                        {
+                                                return &cells[position & mask].data.get();
+                                        }
+
+                                        basic_iterator_t& operator++()
+                                        {
+                                                position++;
+                                                settle();
+                                                return *this;
+                                        }
+
+                                        basic_iterator_t operator++(int)
+                                        {
+                                                const basic_iterator_t previous = *this;
+                                                ++*this;
+                                                return previous;
+                                        }
+
+                                        bool operator==(const basic_iterator_t&) const = default;
+                        };
+
+                public:
+                        using value_type     = DataType;
+                        using iterator       = basic_iterator_t<false>;
+                        using const_iterator = basic_iterator_t<true>;
+
+                        static constexpr std::size_t capacity = Capacity;
+
+                        BoundedRing(): cells(new cell_t[Capacity])
+                        {
+                                for(std::size_t i = 0; i < Capacity; i++) cells[i].sequence.store(i, std::memory_order_relaxed);
+                        }
+
+                        BoundedRing(const BoundedRing&)            = delete;
+                        BoundedRing& operator=(const BoundedRing&) = delete;
+
+                        bool enqueue(const DataType& data)
+                        {
+                                return emplace(data);
+                        }
+
+                        bool enqueue(DataType&& data)
+                        {
+                                return emplace(std::move(data));
+                        }
+
+                        // Returns false if the ring is full, the arguments are only consumed once a cell has been claimed
+                        template<typename... Args>
+                        bool emplace(Args&&... args)
+                        {
+                                std::size_t position = enqueue_position.load(std::memory_order_relaxed);
+                                while(true)
+                                {
+                                        events.add(event_t::loop_iterations);
+                                        cell_t&              cell = cells[position & mask];
+                                        const std::ptrdiff_t diff = distance(cell.sequence.load(std::memory_order_acquire), position);
+                                        if(diff == 0)
+                                        {
+                                                events.add(event_t::cas_attempts);
+                                                if(enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                                                {
+                                                        cell.data.construct(std::forward<Args>(args)...);
+                                                        cell.sequence.store(position + 1, std::memory_order_release);
+                                                        return true;
+                                                }
+                                                events.contended();
+                                        }
+                                        else if(diff < 0) // Ring is full, the cell still holds the element of the previous lap
+                                                return false;
+                                        else
+                                                position = enqueue_position.load(std::memory_order_relaxed);
+                                }
+                        }
+
+                        std::optional<DataType> dequeue()
+                        {
+                                std::size_t position = dequeue_position.load(std::memory_order_relaxed);
+                                while(true)
+                                {
+                                        events.add(event_t::loop_iterations);
+                                        cell_t&              cell = cells[position & mask];
+                                        const std::ptrdiff_t diff = distance(cell.sequence.load(std::memory_order_acquire), position + 1);
+                                        if(diff == 0)
+                                        {
+                                                events.add(event_t::cas_attempts);
+                                                if(dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                                                {
+                                                        std::optional<DataType> value = cell.data.take();
+                                                        cell.sequence.store(position + Capacity, std::memory_order_release);
+                                                        return value;
+                                                }
+                                                events.contended();
+                                        }
+                                        else if(diff < 0) // Ring is empty
+                                                return {};
+                                        else
+                                                position = dequeue_position.load(std::memory_order_relaxed);
+                                }
+                        }
+
+                        template<typename Func>
+                                requires invokable<Func, DataType>
+                        void for_all(Func f)
+                        {
+                                const std::size_t end = enqueue_position.load();
+                                for(std::size_t position = dequeue_position.load(); position != end; position++)
+                                {
+                                        if(published(cells[position & mask], position)) f(cells[position & mask].data.get());
+                                }
+                        }
+
+                        // Traversals must not run concurrently with dequeues, inserts may run alongside
+                        iterator begin()
+                        {
+                                return iterator(cells.get(), dequeue_position.load(), enqueue_position.load());
+                        }
+
+                        iterator end()
+                        {
+                                return {};
+                        }
+
+                        const_iterator begin() const
+                        {
+                                return const_iterator(cells.get(), dequeue_position.load(), enqueue_position.load());
+                        }
+
+                        const_iterator end() const
+                        {
+                                return {};
+                        }
+
+                        // Lost races for a cell position
+                        std::size_t contention() const
+                        {
+                                return events.contention();
+                        }
+
+                        // CAS counts cover the claims of the enqueue and dequeue positions, there is no tail to help
+                        shard_stats_t stats() const
+                        {
+                                return events.snapshot();
+                        }
+
+                        // Everything is allocated up front
+                        static void reserve(std::size_t) {}
+
+                        ~BoundedRing()
+                        {
+                                const std::size_t end = enqueue_position.load();
+                                for(std::size_t position = dequeue_position.load(); position != end; position++)
+                                {
+                                        if(published(cells[position & mask], position)) cells[position & mask].data.destroy();
+                                }
+                        }
+        };
+} // namespace wait_free_bag
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <functional>
+
+namespace wait_free_bag
+{
+        template<typename Func, typename DataType>
+        concept invokable = requires(Func foo, DataType elem) { foo(std::ref(elem)); };
+
+        // For read-only traversals
+        template<typename Func, typename DataType>
+        concept const_invokable = requires(Func foo, const DataType elem) { foo(elem); };
+
+        // Anything that runs a task on some thread, e.g. a thread pool submit wrapped in a lambda
+        template<typename Executor>
+        concept executor = requires(Executor executor, std::function<void()> task) { executor(task); };
+} // namespace wait_free_bag
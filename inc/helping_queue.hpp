@@ -0,0 +1,433 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <concepts.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <linked_iterator.hpp>
+#include <node_pool.hpp>
+#include <optional>
+#include <reclamation.hpp>
+#include <stats.hpp>
+#include <stdexcept>
+#include <storage.hpp>
+#include <thread_registry.hpp>
+#include <utility>
+
+namespace wait_free_bag
+{
+        // Ref: https://csaws.cs.technion.ac.il/~erez/Papers/wfquque-ppopp.pdf
+        // Ref: https://csaws.cs.technion.ac.il/~erez/Papers/wf-methodology-ppopp12.pdf
+        // Wait-free queue in the fast-path/slow-path style of Kogan and Petrank. Operations first run the Michael-Scott algorithm for at most
+        // max_failures attempts. A thread that keeps losing announces its operation with a phase number in the state array and then walks the
+        // whole array, finishing every pending announcement with a phase up to its own, its own included, in the order of the thread ids. An
+        // announced operation is therefore completed at the latest by the slow path of the next thread that announces after it. Fast path
+        // operations also look at one other thread's announcement every helping_delay operations, so announcements do not wait for the next
+        // slow path while the queue is busy. Helpers dereference descriptors and nodes of other threads at arbitrary points, so the queue
+        // relies on EpochReclamation. At most MaxThreads distinct threads may use queues of one type at the same time.
+        template<typename DataType, std::size_t MaxThreads = 256, template<typename> class Allocator = NodePool>
+        class HelpingQueue
+        {
+                private:
+                        using reclaimer_t = EpochReclamation;
+
+                        static constexpr std::size_t max_failures  = 16;
+                        static constexpr std::size_t helping_delay = 64;
+                        static constexpr std::size_t none          = std::numeric_limits<std::size_t>::max();
+                        static constexpr std::size_t fast          = none - 1;
+
+                        struct node_t
+                        {
+                                public:
+                                        storage_t<DataType>      data;
+                                        std::atomic<node_t*>     next    = nullptr;
+                                        std::size_t              enq_tid = none;
+                                        std::atomic<std::size_t> deq_tid = none;
+                        };
+
+                        // Descriptors are immutable, every change of an announcement swaps in a new one
+                        struct desc_t
+                        {
+                                public:
+                                        const std::uint64_t phase;
+                                        const bool          pending;
+                                        const bool          enqueue;
+                                        node_t* const       node;
+                        };
+
+                        struct thread_record_t
+                        {
+                                public:
+                                        static inline std::atomic_size_t next_id = 0;
+
+                                        const std::size_t id        = next_id.fetch_add(1);
+                                        std::size_t       countdown = helping_delay;
+                                        std::size_t       check     = 0;
+                        };
+
+                        using registry_t = ThreadRegistry<thread_record_t>;
+                        using nodes      = NodeLifecycle<node_t, Allocator>;
+
+                        alignas(64) std::atomic<node_t*> head;
+                        alignas(64) std::atomic<node_t*> tail;
+                        alignas(64) std::atomic_uint64_t next_phase = 1;
+                        alignas(64) ShardEvents          events;
+
+                        // One announcement per thread id, nullptr until the thread first takes the slow path
+                        alignas(64) std::array<std::atomic<desc_t*>, MaxThreads> state {};
+
+                        static void retire_desc(desc_t* const desc)
+                        {
+                                if(desc == nullptr) return;
+                                reclaimer_t::retire(desc,
+                                                    [](void* ptr)
+                                                    {
+                                                            delete static_cast<desc_t*>(ptr);
+                                                    });
+                        }
+
+                        static thread_record_t& local()
+                        {
+                                thread_record_t& record = registry_t::local();
+                                if(record.id >= MaxThreads) throw std::logic_error("Too many threads for HelpingQueue\n");
+                                return record;
+                        }
+
+                        // Upper bound of the thread ids handed out so far
+                        static std::size_t thread_bound()
+                        {
+                                return std::min(MaxThreads, thread_record_t::next_id.load());
+                        }
+
+                        bool still_pending(const std::size_t tid, const std::uint64_t phase) const
+                        {
+                                const desc_t* const desc = state[tid].load();
+                                return desc && desc->pending && desc->phase <= phase;
+                        }
+
+                        // Only the owner announces operations, the previous descriptor is never pending at that point
+                        void announce(const std::size_t tid, desc_t* const desc)
+                        {
+                                retire_desc(state[tid].exchange(desc));
+                        }
+
+                        // Helpers race to replace a descriptor, the losers free their copy right away since nobody else has seen it
+                        bool replace_desc(const std::size_t tid, desc_t* expected, desc_t* const desired)
+                        {
+                                if(state[tid].compare_exchange_strong(expected, desired))
+                                {
+                                        retire_desc(expected);
+                                        return true;
+                                }
+                                delete desired;
+                                return false;
+                        }
+
+                        void help_if_needed(thread_record_t& record)
+                        {
+                                if(--record.countdown != 0) [[likely]]
+                                        return;
+
+                                record.countdown     = helping_delay;
+                                const std::size_t id = record.check;
+                                record.check         = (id + 1) % thread_bound();
+
+                                const desc_t* const desc = state[id].load();
+                                if(desc == nullptr || !desc->pending) return;
+                                if(desc->enqueue)
+                                        help_enqueue(id, desc->phase);
+                                else
+                                        help_dequeue(id, desc->phase);
+                        }
+
+                        // Finishes every pending announcement that is not newer than phase
+                        void help(const std::uint64_t phase)
+                        {
+                                const std::size_t bound = thread_bound();
+                                for(std::size_t tid = 0; tid < bound; tid++)
+                                {
+                                        const desc_t* const desc = state[tid].load();
+                                        if(desc == nullptr || !desc->pending || desc->phase > phase) continue;
+                                        if(desc->enqueue)
+                                                help_enqueue(tid, desc->phase);
+                                        else
+                                                help_dequeue(tid, desc->phase);
+                                }
+                        }
+
+                        void help_enqueue(const std::size_t tid, const std::uint64_t phase)
+                        {
+                                while(still_pending(tid, phase))
+                                {
+                                        node_t* const last = tail.load();
+                                        node_t*       next = last->next.load();
+                                        if(last != tail.load()) continue;
+
+                                        if(next != nullptr)
+                                        {
+                                                help_finish_enqueue();
+                                                continue;
+                                        }
+
+                                        // The node cannot have been linked yet: the tail would have to be past it, which requires the announcement to be finished
+                                        const desc_t* const desc = state[tid].load();
+                                        if(!desc->pending || desc->phase > phase || !desc->enqueue) continue;
+                                        if(last->next.compare_exchange_strong(next, desc->node))
+                                        {
+                                                help_finish_enqueue();
+                                                return;
+                                        }
+                                }
+                        }
+
+                        // Finishes the announcement that owns the node after the tail before moving the tail onto it
+                        void help_finish_enqueue()
+                        {
+                                node_t* last = tail.load();
+                                node_t* next = last->next.load();
+                                if(next == nullptr) return;
+
+                                const std::size_t tid = next->enq_tid;
+                                if(tid != none)
+                                {
+                                        desc_t* const desc = state[tid].load();
+                                        if(last == tail.load() && desc->pending && desc->node == next) replace_desc(tid, desc, new desc_t {desc->phase, false, true, next});
+                                }
+                                tail.compare_exchange_strong(last, next);
+                        }
+
+                        void help_dequeue(const std::size_t tid, const std::uint64_t phase)
+                        {
+                                while(still_pending(tid, phase))
+                                {
+                                        node_t* const first = head.load();
+                                        node_t* const last  = tail.load();
+                                        node_t* const next  = first->next.load();
+                                        if(first != head.load()) continue;
+
+                                        desc_t* const desc = state[tid].load();
+                                        if(!desc->pending || desc->phase > phase) break;
+
+                                        if(first == last)
+                                        {
+                                                if(next != nullptr)
+                                                        help_finish_enqueue();
+                                                else if(last == tail.load()) // Queue is empty
+                                                        replace_desc(tid, desc, new desc_t {desc->phase, false, false, nullptr});
+                                                continue;
+                                        }
+
+                                        // Remember the node about to be taken, then try to reserve it for tid. The head is checked again after reading the
+                                        // descriptor so that a stale helper cannot overwrite a newer node.
+                                        if(first == head.load() && desc->node != first && !replace_desc(tid, desc, new desc_t {desc->phase, true, false, first})) continue;
+                                        std::size_t expected = none;
+                                        first->deq_tid.compare_exchange_strong(expected, tid);
+                                        help_finish_dequeue();
+                                }
+                        }
+
+                        // Finishes the operation that reserved the head node before moving the head past it
+                        void help_finish_dequeue()
+                        {
+                                node_t*           first = head.load();
+                                node_t* const     next  = first->next.load();
+                                const std::size_t tid   = first->deq_tid.load();
+                                if(tid == none || next == nullptr) return;
+
+                                if(tid != fast)
+                                {
+                                        desc_t* const desc = state[tid].load();
+                                        if(first == head.load() && desc->pending) replace_desc(tid, desc, new desc_t {desc->phase, false, false, desc->node});
+                                }
+                                node_t* const old = first;
+                                if(head.compare_exchange_strong(first, next)) reclaimer_t::retire(old, nodes::retire);
+                        }
+
+                public:
+                        using value_type     = DataType;
+                        using iterator       = linked_iterator_t<node_t, false>;
+                        using const_iterator = linked_iterator_t<node_t, true>;
+
+                        HelpingQueue()
+                        {
+                                node_t* const node = nodes::create();
+                                if(node == nullptr) throw std::logic_error("Could not allocate queue\n");
+
+                                head.store(node);
+                                tail.store(node);
+                        }
+
+                        HelpingQueue(const HelpingQueue&)            = delete;
+                        HelpingQueue& operator=(const HelpingQueue&) = delete;
+
+                        bool enqueue(const DataType& data)
+                        {
+                                return emplace(data);
+                        }
+
+                        bool enqueue(DataType&& data)
+                        {
+                                return emplace(std::move(data));
+                        }
+
+                        // The node is fully built before the fast path first tries to link it, helpers only ever see finished nodes
+                        template<typename... Args>
+                        bool emplace(Args&&... args)
+                        {
+                                typename reclaimer_t::guard guard;
+                                thread_record_t&            record = local();
+                                help_if_needed(record);
+
+                                node_t* const node = nodes::create();
+                                if(node == nullptr) return false;
+                                try
+                                {
+                                        node->data.construct(std::forward<Args>(args)...);
+                                }
+                                catch(...)
+                                {
+                                        nodes::destroy(node);
+                                        throw;
+                                }
+
+                                for(std::size_t trial = 0; trial < max_failures; trial++)
+                                {
+                                        events.add(event_t::loop_iterations);
+                                        node_t* const last = tail.load();
+                                        node_t*       next = last->next.load();
+                                        if(last != tail.load()) continue;
+
+                                        if(next != nullptr)
+                                        {
+                                                events.add(event_t::tail_helps);
+                                                help_finish_enqueue();
+                                                continue;
+                                        }
+                                        events.add(event_t::cas_attempts);
+                                        if(last->next.compare_exchange_strong(next, node))
+                                        {
+                                                help_finish_enqueue();
+                                                return true;
+                                        }
+                                        events.contended();
+                                }
+
+                                // Slow path, the node is still private so its owner can be set without synchronisation
+                                node->enq_tid             = record.id;
+                                const std::uint64_t phase = next_phase.fetch_add(1);
+                                announce(record.id, new desc_t {phase, true, true, node});
+                                help(phase);
+                                help_finish_enqueue();
+                                return true;
+                        }
+
+                        std::optional<DataType> dequeue()
+                        {
+                                typename reclaimer_t::guard guard;
+                                thread_record_t&            record = local();
+                                help_if_needed(record);
+
+                                for(std::size_t trial = 0; trial < max_failures; trial++)
+                                {
+                                        events.add(event_t::loop_iterations);
+                                        node_t* const first = head.load();
+                                        node_t* const last  = tail.load();
+                                        node_t* const next  = first->next.load();
+                                        if(first != head.load()) continue;
+
+                                        if(first == last)
+                                        {
+                                                if(next == nullptr) return {}; // Queue is empty
+                                                events.add(event_t::tail_helps);
+                                                help_finish_enqueue();
+                                                continue;
+                                        }
+
+                                        // Whoever reserves the head node owns the data of its successor
+                                        std::size_t expected = none;
+                                        events.add(event_t::cas_attempts);
+                                        if(first->deq_tid.compare_exchange_strong(expected, fast))
+                                        {
+                                                help_finish_dequeue();
+                                                return next->data.take();
+                                        }
+                                        events.contended();
+                                        help_finish_dequeue();
+                                }
+
+                                const std::uint64_t phase = next_phase.fetch_add(1);
+                                announce(record.id, new desc_t {phase, true, false, nullptr});
+                                help(phase);
+                                help_finish_dequeue();
+
+                                const node_t* const node = state[record.id].load()->node;
+                                if(node == nullptr) return {};
+                                return node->next.load()->data.take();
+                        }
+
+                        template<typename Func>
+                                requires invokable<Func, DataType>
+                        void for_all(Func f)
+                        {
+                                const node_t* const tail_ptr = tail.load();
+                                for(node_t* iterator = head.load(); iterator != tail_ptr; iterator = iterator->next.load()) f(iterator->next.load()->data.get());
+                        }
+
+                        // Iterators stop at the tail node. Helpers finish dequeues of other threads, so no thread may dequeue during a traversal.
+                        iterator begin()
+                        {
+                                return iterator(head.load());
+                        }
+
+                        iterator end()
+                        {
+                                return iterator(tail.load());
+                        }
+
+                        const_iterator begin() const
+                        {
+                                return const_iterator(head.load());
+                        }
+
+                        const_iterator end() const
+                        {
+                                return const_iterator(tail.load());
+                        }
+
+                        // Counts cover the fast path only, slow path operations are bounded by the helping protocol
+                        shard_stats_t stats() const
+                        {
+                                return events.snapshot();
+                        }
+
+                        // Lost races of the fast path, the slow path does not count
+                        std::size_t contention() const
+                        {
+                                return events.contention();
+                        }
+
+                        // Preallocates nodes only, slow path descriptors always come from the heap
+                        static void reserve(std::size_t count)
+                        {
+                                Allocator<node_t>::reserve(count);
+                        }
+
+                        ~HelpingQueue()
+                        {
+                                // Every node but the dummy node still holds its element
+                                for(node_t* node = head.load()->next.load(); node; node = node->next.load()) node->data.destroy();
+
+                                const node_t* iterator = head.load();
+                                while(iterator)
+                                {
+                                        const node_t* const next = iterator->next.load();
+                                        nodes::destroy(iterator);
+                                        iterator = next;
+                                }
+                                for(std::atomic<desc_t*>& desc: state) delete desc.load();
+                        }
+        };
+} // namespace wait_free_bag
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+namespace wait_free_bag
+{
+        // Forward iterator over a singly linked list that starts with a dummy node. The iterator points at the node before the element it
+        // yields, so the position of the tail node is the end of the list. Nodes keep their value in a storage_t named data.
+        template<typename Node, bool Const>
+        class linked_iterator_t
+        {
+                private:
+                        Node* node = nullptr;
+
+                public:
+                        using iterator_concept  = std::forward_iterator_tag;
+                        using iterator_category = std::forward_iterator_tag;
+                        using value_type        = std::remove_cvref_t<decltype(std::declval<Node&>().data.get())>;
+                        using difference_type   = std::ptrdiff_t;
+                        using reference         = std::conditional_t<Const, const value_type&, value_type&>;
+                        using pointer           = std::conditional_t<Const, const value_type*, value_type*>;
+
+                        linked_iterator_t() = default;
+
+                        explicit linked_iterator_t(Node* const node): node(node) {}
+
+                        reference operator*() const
+                        {
+                                return node->next.load()->data.get();
+                        }
+
+                        pointer operator->() const
+                        {
+                                return &node->next.load()->data.get();
+                        }
+
+                        linked_iterator_t& operator++()
+                        {
+                                node = node->next.load();
+                                return *this;
+                        }
+
+                        linked_iterator_t operator++(int)
+                        {
+                                const linked_iterator_t previous = *this;
+                                ++*this;
+                                return previous;
+                        }
+
+                        bool operator==(const linked_iterator_t&) const = default;
+        };
+} // namespace wait_free_bag
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <numa.hpp>
+#include <thread_registry.hpp>
+
+namespace wait_free_bag
+{
+        // Plain global heap allocation, one call to the system allocator per node
+        template<typename Node>
+        class HeapAllocator
+        {
+                public:
+                        static void* allocate()
+                        {
+                                return std::allocator<Node>().allocate(1);
+                        }
+
+                        static void deallocate(void* ptr) noexcept
+                        {
+                                std::allocator<Node>().deallocate(static_cast<Node*>(ptr), 1);
+                        }
+
+                        static void reserve(std::size_t) {}
+        };
+
+        // Per-thread slab allocator for fixed size nodes.
+        // Every thread owns a pool which hands out nodes carved from large aligned slabs. A node freed by its owner goes back to the owner's
+        // private free list, a node freed by any other thread is pushed onto the owner's lock-free remote list and is picked up in bulk once
+        // the private list runs dry. The owner of a node is found by masking its address down to the slab header, so nodes carry no overhead.
+        // Pools of exited threads are adopted by new threads (see ThreadRegistry), slabs are never returned to the system. Slabs are placed on
+        // the NUMA node of the thread that grows the pool, so nodes are local to the producers that allocate them.
+        template<typename Node>
+        class NodePool
+        {
+                private:
+                        struct free_node_t
+                        {
+                                public:
+                                        free_node_t* next;
+                        };
+
+                        struct pool_t;
+
+                        struct slab_t
+                        {
+                                public:
+                                        pool_t* owner;
+                                        slab_t* next;
+                        };
+
+                        static constexpr std::size_t slot_align  = std::max(alignof(Node), alignof(free_node_t));
+                        static constexpr std::size_t slot_size   = (std::max(sizeof(Node), sizeof(free_node_t)) + slot_align - 1) / slot_align * slot_align;
+                        static constexpr std::size_t header_size = (sizeof(slab_t) + slot_align - 1) / slot_align * slot_align;
+                        static constexpr std::size_t slab_size   = std::bit_ceil(std::max<std::size_t>(1UZ << 16, header_size + (64 * slot_size)));
+                        static constexpr std::size_t slab_slots  = (slab_size - header_size) / slot_size;
+
+                        struct pool_t
+                        {
+                                public:
+                                        free_node_t*              local_free  = nullptr;
+                                        std::size_t               local_count = 0;
+                                        slab_t*                   slabs       = nullptr;
+                                        std::atomic<free_node_t*> remote_free = nullptr;
+
+                                        void grow()
+                                        {
+                                                const NumaTopology& topology = NumaTopology::instance();
+                                                std::byte* const    raw      = static_cast<std::byte*>(::operator new(slab_size, std::align_val_t {slab_size}));
+                                                topology.bind(raw, slab_size, topology.current_node());
+
+                                                slab_t* const slab = new(raw) slab_t {this, slabs};
+                                                slabs              = slab;
+
+                                                for(std::size_t i = 0; i < slab_slots; i++)
+                                                {
+                                                        free_node_t* const node = new(raw + header_size + (i * slot_size)) free_node_t {local_free};
+                                                        local_free              = node;
+                                                }
+                                                local_count += slab_slots;
+                                        }
+
+                                        void drain_remote()
+                                        {
+                                                free_node_t* node = remote_free.exchange(nullptr, std::memory_order_acquire);
+                                                while(node)
+                                                {
+                                                        free_node_t* const next = node->next;
+                                                        node->next              = local_free;
+                                                        local_free              = node;
+                                                        local_count++;
+                                                        node = next;
+                                                }
+                                        }
+                        };
+
+                        using registry_t = ThreadRegistry<pool_t>;
+
+                public:
+                        static void* allocate()
+                        {
+                                pool_t& pool = registry_t::local();
+                                if(!pool.local_free)
+                                {
+                                        pool.drain_remote();
+                                        if(!pool.local_free) pool.grow();
+                                }
+
+                                free_node_t* const node = pool.local_free;
+                                pool.local_free         = node->next;
+                                pool.local_count--;
+                                return node;
+                        }
+
+                        static void deallocate(void* ptr) noexcept
+                        {
+                                const slab_t* const slab  = reinterpret_cast<const slab_t*>(reinterpret_cast<std::uintptr_t>(ptr) & ~(slab_size - 1));
+                                pool_t* const       owner = slab->owner;
+                                pool_t&             pool  = registry_t::local();
+                                free_node_t* const  node  = new(ptr) free_node_t {nullptr};
+
+                                if(owner == &pool)
+                                {
+                                        node->next      = pool.local_free;
+                                        pool.local_free = node;
+                                        pool.local_count++;
+                                        return;
+                                }
+
+                                node->next = owner->remote_free.load(std::memory_order_relaxed);
+                                while(!owner->remote_free.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed));
+                        }
+
+                        // Makes sure that the calling thread can allocate at least count nodes without touching the system allocator
+                        static void reserve(std::size_t count)
+                        {
+                                pool_t& pool = registry_t::local();
+                                pool.drain_remote();
+                                while(pool.local_count < count) pool.grow();
+                        }
+        };
+
+        // Construction and destruction of the nodes of the linked shards on top of an allocator policy. Node needs a data member of type
+        // storage_t and an atomic next pointer.
+        template<typename Node, template<typename> class Allocator>
+        class NodeLifecycle
+        {
+                public:
+                        static Node* create()
+                        {
+                                return new(Allocator<Node>::allocate()) Node();
+                        }
+
+                        static void destroy(const Node* const node)
+                        {
+                                node->~Node();
+                                Allocator<Node>::deallocate(const_cast<Node*>(node));
+                        }
+
+                        // Deleter for Reclaimer::retire
+                        static void retire(void* node)
+                        {
+                                destroy(static_cast<Node*>(node));
+                        }
+
+                        // Nodes the tagged pointer policy cannot hold are handed back right away
+                        template<template<typename> class TaggedPointer>
+                        static Node* create_usable()
+                        {
+                                Node* const node = create();
+                                if(node == nullptr || TaggedPointer<Node>::representable(node)) return node;
+                                destroy(node);
+                                return nullptr;
+                        }
+
+                        // Hands back a private chain that was never published, only its first constructed nodes hold an element
+                        static void discard_chain(Node* node, std::size_t constructed)
+                        {
+                                while(node)
+                                {
+                                        Node* const next = node->next.load(std::memory_order_relaxed);
+                                        if(constructed > 0)
+                                        {
+                                                node->data.destroy();
+                                                constructed--;
+                                        }
+                                        destroy(node);
+                                        node = next;
+                                }
+                        }
+        };
+} // namespace wait_free_bag
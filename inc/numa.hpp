@@ -0,0 +1,112 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+namespace wait_free_bag
+{
+        // NUMA topology of the machine, read once from /sys/devices/system/node. Nodes are numbered densely from 0 in the order of their
+        // system ids. Machines without that directory, with a single node or with an unreadable layout are treated as one node, in which case
+        // current_node() always returns 0 and bind() does nothing.
+        class NumaTopology
+        {
+                private:
+                        static constexpr const char* node_directory = "/sys/devices/system/node/";
+
+                        std::vector<int>         node_ids;
+                        std::vector<std::size_t> cpu_nodes;
+
+                        // Parses lists like "0-3,8,10-11" as found in the online and cpulist files
+                        static std::vector<std::size_t> parse_list(const std::string& path)
+                        {
+                                std::vector<std::size_t> values;
+                                std::ifstream            file(path);
+                                std::string              list;
+                                if(!std::getline(file, list)) return values;
+
+                                std::size_t position = 0;
+                                while(position < list.size())
+                                {
+                                        const std::size_t end   = std::min(list.find(',', position), list.size());
+                                        const std::string range = list.substr(position, end - position);
+                                        const std::size_t dash  = range.find('-');
+                                        try
+                                        {
+                                                const std::size_t first = std::stoul(range.substr(0, dash));
+                                                const std::size_t last  = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+                                                for(std::size_t value = first; value <= last; value++) values.push_back(value);
+                                        }
+                                        catch(...)
+                                        {
+                                                return {};
+                                        }
+                                        position = end + 1;
+                                }
+                                return values;
+                        }
+
+                        NumaTopology()
+                        {
+                                const std::vector<std::size_t> online = parse_list(std::string(node_directory) + "online");
+                                for(const std::size_t id: online)
+                                {
+                                        const std::vector<std::size_t> cpus = parse_list(std::string(node_directory) + "node" + std::to_string(id) + "/cpulist");
+                                        for(const std::size_t cpu: cpus)
+                                        {
+                                                if(cpu >= cpu_nodes.size()) cpu_nodes.resize(cpu + 1, 0);
+                                                cpu_nodes[cpu] = node_ids.size();
+                                        }
+                                        node_ids.push_back(static_cast<int>(id));
+                                }
+
+                                if(node_ids.size() <= 1)
+                                {
+                                        node_ids  = {0};
+                                        cpu_nodes = {};
+                                }
+                        }
+
+                public:
+                        static const NumaTopology& instance()
+                        {
+                                static const NumaTopology topology;
+                                return topology;
+                        }
+
+                        std::size_t nodes() const
+                        {
+                                return node_ids.size();
+                        }
+
+                        // Node of the CPU the calling thread runs on right now, looked up anew on every call. Bags cache the home shard they pick
+                        // from this node (see WaitFreeBag::home_shard), so a thread that migrates keeps inserting into the shards of the node it
+                        // saw first until the home is picked again. Steals and pool growth always use the current node.
+                        std::size_t current_node() const
+                        {
+                                if(cpu_nodes.empty()) return 0;
+                                const int cpu = sched_getcpu();
+                                if(cpu < 0 || static_cast<std::size_t>(cpu) >= cpu_nodes.size()) return 0;
+                                return cpu_nodes[static_cast<std::size_t>(cpu)];
+                        }
+
+                        // Asks the kernel to place the pages of [ptr, ptr + size) on node, ptr must be page aligned. Pages already touched are
+                        // moved where possible. Placement is only a preference: failures are ignored and the memory stays usable either way.
+                        void bind(void* const ptr, const std::size_t size, const std::size_t node) const
+                        {
+                                if(nodes() <= 1 || node >= nodes()) return;
+
+                                constexpr std::size_t      mask_bits = 8 * sizeof(unsigned long);
+                                const std::size_t          id        = static_cast<std::size_t>(node_ids[node]);
+                                std::vector<unsigned long> mask((id / mask_bits) + 1, 0);
+                                mask[id / mask_bits] = 1UL << (id % mask_bits);
+                                syscall(SYS_mbind, ptr, size, MPOL_PREFERRED, mask.data(), (mask.size() * mask_bits) + 1, MPOL_MF_MOVE);
+                        }
+        };
+} // namespace wait_free_bag
@@ -0,0 +1,270 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread_registry.hpp>
+#include <vector>
+
+namespace wait_free_bag
+{
+        // Reclamation policies decide when a node unlinked from a shard may be handed back to its allocator.
+        // Every operation that dereferences shared nodes runs under a Reclaimer::guard. Pointers read from shared locations are published
+        // through guard.protect(slot, source, strip) or guard.publish(slot, pointer) followed by a validation of the location it was read
+        // from. The source of protect may be anything with a load() member, strip turns the loaded value into a plain pointer. Unlinked
+        // nodes are passed to Reclaimer::retire together with a function that destroys them.
+        // Guards must not be nested on the same thread unless the policy says otherwise.
+
+        // Frees nodes right away. Only safe when no other thread can still be reading the node, kept as a baseline for benchmarking.
+        class NoReclamation
+        {
+                public:
+                        class guard
+                        {
+                                public:
+                                        template<typename Source, typename Strip>
+                                        auto protect(std::size_t, const Source& source, Strip)
+                                        {
+                                                return source.load();
+                                        }
+
+                                        void publish(std::size_t, const void*) {}
+                        };
+
+                        static void retire(void* ptr, void (*deleter)(void*))
+                        {
+                                deleter(ptr);
+                        }
+        };
+
+        // Ref: https://www.cs.otago.ac.nz/cosc440/readings/hazard-pointers.pdf
+        // Every thread owns a handful of hazard slots. Retired nodes are buffered in a per-thread list and only scanned against all published
+        // hazards once the list has grown past a threshold proportional to the number of hazard slots, which amortises the scan.
+        class HazardPointers
+        {
+                public:
+                        static constexpr std::size_t slots = 4;
+
+                private:
+                        struct retired_t
+                        {
+                                public:
+                                        void* ptr;
+                                        void (*deleter)(void*);
+                        };
+
+                        struct record_t
+                        {
+                                public:
+                                        std::array<std::atomic<const void*>, slots> hazards {};
+                                        std::vector<retired_t>                      retired;
+                                        std::vector<const void*>                    scratch;
+
+                                        void scan()
+                                        {
+                                                scratch.clear();
+                                                std::atomic_thread_fence(std::memory_order_seq_cst);
+                                                registry_t::instance().for_each(
+                                                        [this](record_t& record)
+                                                        {
+                                                                for(const std::atomic<const void*>& hazard: record.hazards)
+                                                                {
+                                                                        const void* const ptr = hazard.load(std::memory_order_acquire);
+                                                                        if(ptr) scratch.push_back(ptr);
+                                                                }
+                                                        });
+                                                std::sort(scratch.begin(), scratch.end());
+
+                                                const auto protected_end = std::partition(retired.begin(),
+                                                                                          retired.end(),
+                                                                                          [this](const retired_t& node)
+                                                                                          {
+                                                                                                  return std::binary_search(scratch.begin(), scratch.end(), node.ptr);
+                                                                                          });
+                                                for(auto it = protected_end; it != retired.end(); it++) it->deleter(it->ptr);
+                                                retired.erase(protected_end, retired.end());
+                                        }
+
+                                        void release()
+                                        {
+                                                for(std::atomic<const void*>& hazard: hazards) hazard.store(nullptr, std::memory_order_release);
+                                                scan();
+                                        }
+                        };
+
+                        using registry_t = ThreadRegistry<record_t>;
+
+                public:
+                        class guard
+                        {
+                                private:
+                                        record_t& record;
+
+                                public:
+                                        guard(): record(registry_t::local()) {}
+
+                                        guard(const guard&)            = delete;
+                                        guard& operator=(const guard&) = delete;
+
+                                        template<typename Source, typename Strip>
+                                        auto protect(std::size_t slot, const Source& source, Strip strip)
+                                        {
+                                                auto value = source.load();
+                                                while(true)
+                                                {
+                                                        record.hazards[slot].store(strip(value));
+                                                        const auto current = source.load();
+                                                        if(current == value) return value;
+                                                        value = current;
+                                                }
+                                        }
+
+                                        void publish(std::size_t slot, const void* ptr)
+                                        {
+                                                record.hazards[slot].store(ptr);
+                                        }
+
+                                        ~guard()
+                                        {
+                                                for(std::atomic<const void*>& hazard: record.hazards) hazard.store(nullptr, std::memory_order_release);
+                                        }
+                        };
+
+                        static void retire(void* ptr, void (*deleter)(void*))
+                        {
+                                record_t& record = registry_t::local();
+                                record.retired.push_back({ptr, deleter});
+
+                                const std::size_t threshold = std::max<std::size_t>(64, 2 * slots * registry_t::instance().size());
+                                if(record.retired.size() >= threshold) record.scan();
+                        }
+        };
+
+        // Ref: https://www.cl.cam.ac.uk/techreports/UCAM-CL-TR-579.pdf
+        // Threads announce the global epoch while inside a guard. Nodes retired in epoch e go to one of three per-thread limbo lists and are
+        // freed once the global epoch reaches e + 2, at which point no guard that could have seen them is still open. Guards may be nested.
+        class EpochReclamation
+        {
+                private:
+                        static constexpr std::size_t collect_interval = 64;
+
+                        struct retired_t
+                        {
+                                public:
+                                        void* ptr;
+                                        void (*deleter)(void*);
+                        };
+
+                        struct limbo_t
+                        {
+                                public:
+                                        std::uint64_t          epoch = 0;
+                                        std::vector<retired_t> nodes;
+
+                                        void free()
+                                        {
+                                                for(const retired_t& node: nodes) node.deleter(node.ptr);
+                                                nodes.clear();
+                                        }
+                        };
+
+                        struct record_t
+                        {
+                                public:
+                                        // Epoch shifted left by one with the lowest bit set while the owner is inside a guard
+                                        std::atomic<std::uint64_t> announced = 0;
+                                        std::size_t                nesting   = 0;
+                                        std::size_t                retired   = 0;
+                                        std::array<limbo_t, 3>     limbo;
+
+                                        void collect()
+                                        {
+                                                try_advance();
+                                                const std::uint64_t epoch = global_epoch().load(std::memory_order_acquire);
+                                                for(limbo_t& list: limbo)
+                                                {
+                                                        if(list.epoch + 2 <= epoch) list.free();
+                                                }
+                                        }
+
+                                        void release()
+                                        {
+                                                collect();
+                                        }
+                        };
+
+                        using registry_t = ThreadRegistry<record_t>;
+
+                        static std::atomic<std::uint64_t>& global_epoch()
+                        {
+                                static std::atomic<std::uint64_t> epoch = 2;
+                                return epoch;
+                        }
+
+                        static void try_advance()
+                        {
+                                std::uint64_t epoch   = global_epoch().load();
+                                bool          stalled = false;
+                                registry_t::instance().for_each(
+                                        [&](const record_t& record)
+                                        {
+                                                const std::uint64_t announced = record.announced.load();
+                                                if((announced & 1) && (announced >> 1) != epoch) stalled = true;
+                                        });
+                                if(!stalled) global_epoch().compare_exchange_strong(epoch, epoch + 1);
+                        }
+
+                public:
+                        class guard
+                        {
+                                private:
+                                        record_t& record;
+
+                                public:
+                                        guard(): record(registry_t::local())
+                                        {
+                                                if(record.nesting++ == 0)
+                                                {
+                                                        record.announced.store((global_epoch().load() << 1) | 1);
+                                                        std::atomic_thread_fence(std::memory_order_seq_cst);
+                                                }
+                                        }
+
+                                        guard(const guard&)            = delete;
+                                        guard& operator=(const guard&) = delete;
+
+                                        template<typename Source, typename Strip>
+                                        auto protect(std::size_t, const Source& source, Strip)
+                                        {
+                                                return source.load();
+                                        }
+
+                                        void publish(std::size_t, const void*) {}
+
+                                        ~guard()
+                                        {
+                                                if(--record.nesting == 0) record.announced.store(0, std::memory_order_release);
+                                        }
+                        };
+
+                        static void retire(void* ptr, void (*deleter)(void*))
+                        {
+                                // The global epoch has to be read after the node was unlinked, the announced one may be stale by then
+                                record_t&           record = registry_t::local();
+                                const std::uint64_t epoch  = global_epoch().load();
+
+                                // A list still holding an older epoch is at least three epochs behind and therefore safe to free
+                                limbo_t& list = record.limbo[epoch % 3];
+                                if(list.epoch != epoch)
+                                {
+                                        list.free();
+                                        list.epoch = epoch;
+                                }
+                                list.nodes.push_back({ptr, deleter});
+
+                                if(++record.retired % collect_interval == 0) record.collect();
+                        }
+        };
+} // namespace wait_free_bag
@@ -0,0 +1,342 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <concepts.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <reclamation.hpp>
+#include <stats.hpp>
+#include <storage.hpp>
+#include <type_traits>
+#include <utility>
+
+namespace wait_free_bag
+{
+        // Ref: https://github.com/pramalhe/ConcurrencyFreaks/blob/master/CPP/queues/array/FAAArrayQueue.hpp
+        // Linked list of fixed size segments. Enqueuers and dequeuers claim slots with a fetch-and-add on the segment indices, so an operation
+        // usually touches a single index and a single slot instead of chasing and allocating one node per element. Values are stored inline
+        // in one contiguous array per segment and for_all streams through those arrays. A dequeuer never waits for an enqueuer: it abandons a
+        // slot that is still empty or being written, and an enqueuer whose slot was abandoned moves its element on to another slot.
+        template<typename DataType, std::size_t SegmentSize = 256, typename Reclaimer = HazardPointers>
+        class SegmentedQueue
+        {
+                private:
+                        enum slot_state_t : std::uint8_t
+                        {
+                                empty,
+                                writing,
+                                full,
+                                abandoned
+                        };
+
+                        struct segment_t
+                        {
+                                public:
+                                        alignas(64) std::atomic<std::size_t> enq_idx = 0;
+                                        alignas(64) std::atomic<std::size_t> deq_idx = 0;
+                                        alignas(64) std::atomic<segment_t*> next     = nullptr;
+                                        std::array<std::atomic<slot_state_t>, SegmentSize> states {};
+                                        alignas(64) std::array<storage_t<DataType>, SegmentSize> values;
+                        };
+
+                        alignas(64) std::atomic<segment_t*> head;
+                        alignas(64) std::atomic<segment_t*> tail;
+                        alignas(64) ShardEvents             events;
+
+                        static segment_t* identity(segment_t* const ptr)
+                        {
+                                return ptr;
+                        }
+
+                        static void retire_segment(segment_t* const segment)
+                        {
+                                Reclaimer::retire(segment,
+                                                  [](void* ptr)
+                                                  {
+                                                          delete static_cast<segment_t*>(ptr);
+                                                  });
+                        }
+
+                        // Marks a slot the caller has just written as full. Fails if a dequeuer abandoned the slot in the meantime, nobody will
+                        // read it then and the caller has to take its element back out.
+                        bool publish(segment_t* const segment, const std::size_t idx)
+                        {
+                                slot_state_t expected = writing;
+                                if(segment->states[idx].compare_exchange_strong(expected, full, std::memory_order_release, std::memory_order_relaxed)) return true;
+                                events.contended();
+                                return false;
+                        }
+
+                        // Visits the full slots in [deq_idx, enq_idx) of every segment, slots that are still being written or were abandoned are skipped
+                        template<bool Const>
+                        class basic_iterator_t
+                        {
+                                private:
+                                        segment_t*  segment = nullptr;
+                                        std::size_t index   = 0;
+                                        std::size_t stop    = 0;
+
+                                        void settle()
+                                        {
+                                                while(segment)
+                                                {
+                                                        while(index < stop && segment->states[index].load(std::memory_order_acquire) != full) index++;
+                                                        if(index < stop) return;
+                                                        segment = segment->next.load();
+                                                        if(segment) enter();
+                                                }
+                                                index = stop = 0;
+                                        }
+
+                                        void enter()
+                                        {
+                                                index = std::min(segment->deq_idx.load(), SegmentSize);
+                                                stop  = std::max(index, std::min(segment->enq_idx.load(), SegmentSize));
+                                        }
+
+                                public:
+                                        using iterator_concept  = std::forward_iterator_tag;
+                                        using iterator_category = std::forward_iterator_tag;
+                                        using value_type        = DataType;
+                                        using difference_type   = std::ptrdiff_t;
+                                        using reference         = std::conditional_t<Const, const DataType&, DataType&>;
+                                        using pointer           = std::conditional_t<Const, const DataType*, DataType*>;
+
+                                        basic_iterator_t() = default;
+
+                                        explicit basic_iterator_t(segment_t* const segment): segment(segment)
+                                        {
+                                                if(segment) enter();
+                                                settle();
+                                        }
+
+                                        reference operator*() const
+                                        {
+                                                return segment->values[index].get();
+                                        }
+
+                                        pointer operator->() const
+                                        {
+                                                return &segment->values[index].get();
+                                        }
+
+                                        basic_iterator_t& operator++()
+                                        {
+                                                index++;
+                                                settle();
+                                                return *this;
+                                        }
+
+                                        basic_iterator_t operator++(int)
+                                        {
+                                                const basic_iterator_t previous = *this;
+                                                ++*this;
+                                                return previous;
+                                        }
+
+                                        bool operator==(const basic_iterator_t& other) const
+                                        {
+                                                return segment == other.segment && index == other.index;
+                                        }
+                        };
+
+                public:
+                        using value_type     = DataType;
+                        using iterator       = basic_iterator_t<false>;
+                        using const_iterator = basic_iterator_t<true>;
+
+                        SegmentedQueue()
+                        {
+                                segment_t* const segment = new segment_t();
+                                head.store(segment);
+                                tail.store(segment);
+                        }
+
+                        bool enqueue(const DataType& data)
+                        {
+                                return emplace(data);
+                        }
+
+                        bool enqueue(DataType&& data)
+                        {
+                                return emplace(std::move(data));
+                        }
+
+                        // Constructs the element right inside its slot. The arguments are only consumed once a slot has been claimed, should a
+                        // dequeuer abandon the slot while it is being written the element is moved out again and into the next slot.
+                        template<typename... Args>
+                        bool emplace(Args&&... args)
+                        {
+                                typename Reclaimer::guard guard;
+                                std::optional<DataType>   moved;
+
+                                const auto fill = [&](storage_t<DataType>& value)
+                                {
+                                        if(moved)
+                                                value.construct(std::move(*moved));
+                                        else
+                                                value.construct(std::forward<Args>(args)...);
+                                };
+
+                                while(true)
+                                {
+                                        events.add(event_t::loop_iterations);
+                                        segment_t* const  tail_copy = guard.protect(0, tail, identity);
+                                        const std::size_t idx       = tail_copy->enq_idx.fetch_add(1);
+                                        if(idx < SegmentSize)
+                                        {
+                                                // The slot may have been abandoned by a dequeuer that overtook us
+                                                slot_state_t expected = empty;
+                                                events.add(event_t::cas_attempts);
+                                                if(!tail_copy->states[idx].compare_exchange_strong(expected, writing, std::memory_order_acquire))
+                                                {
+                                                        events.contended();
+                                                        continue;
+                                                }
+                                                fill(tail_copy->values[idx]);
+                                                if(publish(tail_copy, idx)) return true;
+                                                moved.emplace(tail_copy->values[idx].take());
+                                                continue;
+                                        }
+
+                                        // The segment is full, either append a new one or help moving the tail
+                                        if(tail_copy != tail.load()) continue;
+                                        segment_t* next = tail_copy->next.load();
+                                        if(next == nullptr)
+                                        {
+                                                segment_t* const segment = new segment_t();
+                                                segment->enq_idx.store(1, std::memory_order_relaxed);
+                                                segment->states[0].store(writing, std::memory_order_relaxed);
+
+                                                // Dequeuers may abandon slot 0 and drain the segment before it is written, so it has to stay protected
+                                                guard.publish(1, segment);
+                                                events.add(event_t::cas_attempts);
+                                                if(tail_copy->next.compare_exchange_strong(next, segment))
+                                                {
+                                                        fill(segment->values[0]);
+                                                        const bool published = publish(segment, 0);
+                                                        if(!published) moved.emplace(segment->values[0].take());
+                                                        segment_t* expected = tail_copy;
+                                                        tail.compare_exchange_strong(expected, segment);
+                                                        if(published) return true;
+                                                        continue;
+                                                }
+                                                events.contended();
+                                                delete segment;
+                                        }
+                                        else
+                                        {
+                                                events.add(event_t::tail_helps);
+                                                segment_t* expected = tail_copy;
+                                                tail.compare_exchange_strong(expected, next);
+                                        }
+                                }
+                        }
+
+                        std::optional<DataType> dequeue()
+                        {
+                                typename Reclaimer::guard guard;
+
+                                while(true)
+                                {
+                                        events.add(event_t::loop_iterations);
+                                        segment_t* const head_copy = guard.protect(0, head, identity);
+                                        if(head_copy->deq_idx.load() >= head_copy->enq_idx.load() && head_copy->next.load() == nullptr) return {}; // Queue is empty
+
+                                        const std::size_t idx = head_copy->deq_idx.fetch_add(1);
+                                        if(idx >= SegmentSize)
+                                        {
+                                                // The segment is drained, move on to the next one
+                                                segment_t* const next = head_copy->next.load();
+                                                if(next == nullptr) return {};
+
+                                                // The tail must never point to a retired segment
+                                                segment_t* expected = head_copy;
+                                                tail.compare_exchange_strong(expected, next);
+                                                expected = head_copy;
+                                                if(head.compare_exchange_strong(expected, next)) retire_segment(head_copy);
+                                                continue;
+                                        }
+
+                                        // Give up on slots whose enqueuer has not shown up yet or is still writing, the enqueuer will pick another one. The
+                                        // state only moves forward, so this loop retries at most twice.
+                                        std::atomic<slot_state_t>& state   = head_copy->states[idx];
+                                        slot_state_t               current = state.load(std::memory_order_acquire);
+                                        while(current != full && !state.compare_exchange_strong(current, abandoned, std::memory_order_acquire));
+                                        if(current == full) return head_copy->values[idx].take();
+                                }
+                        }
+
+                        template<typename Func>
+                                requires invokable<Func, DataType>
+                        void for_all(Func f)
+                        {
+                                for(segment_t* segment = head.load(); segment; segment = segment->next.load())
+                                {
+                                        const std::size_t begin = std::min(segment->deq_idx.load(), SegmentSize);
+                                        const std::size_t end   = std::min(segment->enq_idx.load(), SegmentSize);
+                                        for(std::size_t i = begin; i < end; i++)
+                                        {
+                                                if(segment->states[i].load(std::memory_order_acquire) == full) f(segment->values[i].get());
+                                        }
+                                }
+                        }
+
+                        // Iterators read the segment indices when they enter a segment, a concurrent dequeue may retire a drained segment under
+                        // them
+                        iterator begin()
+                        {
+                                return iterator(head.load());
+                        }
+
+                        iterator end()
+                        {
+                                return iterator();
+                        }
+
+                        const_iterator begin() const
+                        {
+                                return const_iterator(head.load());
+                        }
+
+                        const_iterator end() const
+                        {
+                                return const_iterator();
+                        }
+
+                        // Slots lost to overtaking dequeuers and segments appended by another thread first
+                        std::size_t contention() const
+                        {
+                                return events.contention();
+                        }
+
+                        // CAS counts cover slot claims and segment appends, tail helps count moves of a tail that lags behind a full segment
+                        shard_stats_t stats() const
+                        {
+                                return events.snapshot();
+                        }
+
+                        // Segments are allocated once every SegmentSize elements, there is nothing worth reserving per thread
+                        static void reserve(std::size_t) {}
+
+                        ~SegmentedQueue()
+                        {
+                                segment_t* segment = head.load();
+                                while(segment)
+                                {
+                                        // Claimed slots were either taken or abandoned, every full slot past them still holds its element
+                                        for(std::size_t i = std::min(segment->deq_idx.load(), SegmentSize); i < SegmentSize; i++)
+                                        {
+                                                if(segment->states[i].load() == full) segment->values[i].destroy();
+                                        }
+                                        segment_t* const next = segment->next.load();
+                                        delete segment;
+                                        segment = next;
+                                }
+                        }
+        };
+} // namespace wait_free_bag
@@ -0,0 +1,413 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <concepts.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <type_traits>
+#include <unistd.h>
+
+namespace wait_free_bag
+{
+        // Ref: https://www.cs.rochester.edu/~scott/papers/1996_PODC_queues.pdf
+        // Bag that lives entirely inside a shared memory mapping, so several processes can use it at the same time and a process can reattach to
+        // the contents a previous one left behind. The backing object can be a file, a memfd or a POSIX shared memory object. Everything in the
+        // region is position independent: nodes come from an arena inside the region and refer to each other by index, and the shards are
+        // Michael-Scott queues whose head, tail and links are 32-bit indices tagged with a 32-bit counter in one 64-bit word. Freed nodes go
+        // back to a free list in the region and are never unmapped, which is the recycling scheme of the original paper: a stale reader may
+        // look at a recycled node, but its CAS fails on the tag. Values are copied in and out of the nodes word by word, so only trivially
+        // copyable types can be stored. A process that dies in the middle of an operation leaks the node it held. If it dies after linking
+        // its node but before counting it, the element stays in its shard although the counters say otherwise: extract still finds it once
+        // every shard looks empty, but size and size_approx stay off by one for every such crash.
+        template<typename DataType, std::size_t Shards = 16>
+        class SharedBag
+        {
+                private:
+                        static_assert(std::is_trivially_copyable_v<DataType>, "Only trivially copyable elements can be shared between processes");
+                        static_assert(Shards > 0, "A bag needs at least one shard");
+                        static_assert(std::atomic_uint64_t::is_always_lock_free, "Shared atomics must be lock-free to work across processes");
+
+                        static constexpr std::uint64_t magic            = 0x5746424147534D31; // WFBAGSM1
+                        static constexpr std::uint32_t version          = 1;
+                        static constexpr std::uint64_t index_mask       = 0xFFFFFFFF;
+                        static constexpr std::uint32_t state_empty      = 0;
+                        static constexpr std::uint32_t state_creating   = 1;
+                        static constexpr std::uint32_t state_ready      = 2;
+                        static constexpr auto          creation_timeout = std::chrono::seconds(10);
+                        static constexpr std::size_t   words            = (sizeof(DataType) + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t);
+                        static constexpr std::size_t   size_scans       = 64;
+
+                        // Tagged index: node index + 1 in the lower half, 0 is null, and a modification counter in the upper half
+                        static std::uint64_t pack(const std::uint64_t index, const std::uint64_t tag)
+                        {
+                                return (tag << 32) | index;
+                        }
+
+                        static std::uint64_t index_of(const std::uint64_t tagged)
+                        {
+                                return tagged & index_mask;
+                        }
+
+                        static std::uint64_t tag_of(const std::uint64_t tagged)
+                        {
+                                return tagged >> 32;
+                        }
+
+                        struct node_t
+                        {
+                                public:
+                                        std::array<std::atomic_uint64_t, words> value;
+                                        std::atomic_uint64_t                    next;
+                        };
+
+                        struct alignas(64) shard_t
+                        {
+                                public:
+                                        alignas(64) std::atomic_uint64_t head;
+                                        alignas(64) std::atomic_uint64_t tail;
+                                        alignas(64) std::atomic_int64_t inserted;
+                                        std::atomic_int64_t             extracted;
+                        };
+
+                        // Start of the region. A new backing object is zero filled, which leaves the state empty. The layout fields reject regions
+                        // created for another element type, shard count or capacity.
+                        struct alignas(64) header_t
+                        {
+                                public:
+                                        std::uint64_t                    magic;
+                                        std::uint32_t                    version;
+                                        std::uint32_t                    shards;
+                                        std::uint64_t                    element_size;
+                                        std::uint64_t                    capacity;
+                                        std::atomic_uint32_t             state;
+                                        alignas(64) std::atomic_uint64_t free_top;
+                                        std::atomic_uint64_t             bump;
+                                        std::array<shard_t, Shards>      shard;
+                        };
+
+                        std::size_t capacity_;
+                        std::size_t region_size;
+                        header_t*   header = nullptr;
+                        node_t*     nodes  = nullptr;
+
+                        static std::size_t size_for(const std::size_t capacity)
+                        {
+                                return sizeof(header_t) + ((capacity + Shards) * sizeof(node_t));
+                        }
+
+                        node_t& node(const std::uint64_t tagged) const
+                        {
+                                return nodes[index_of(tagged) - 1];
+                        }
+
+                        // Every write of a link bumps its tag, so a CAS prepared before the node was recycled can never succeed
+                        static void relink(node_t& node, const std::uint64_t index)
+                        {
+                                node.next.store(pack(index, tag_of(node.next.load(std::memory_order_relaxed)) + 1), std::memory_order_relaxed);
+                        }
+
+                        static void store(node_t& node, const DataType& data)
+                        {
+                                std::array<std::uint64_t, words> buffer {};
+                                std::memcpy(buffer.data(), &data, sizeof(DataType));
+                                for(std::size_t i = 0; i < words; i++) node.value[i].store(buffer[i], std::memory_order_relaxed);
+                        }
+
+                        static DataType load(const node_t& node)
+                        {
+                                std::array<std::uint64_t, words>        buffer {};
+                                std::array<std::byte, sizeof(DataType)> bytes {};
+                                for(std::size_t i = 0; i < words; i++) buffer[i] = node.value[i].load(std::memory_order_relaxed);
+                                std::memcpy(bytes.data(), buffer.data(), sizeof(DataType));
+                                return std::bit_cast<DataType>(bytes);
+                        }
+
+                        // Index of a free node, or 0 once the arena is exhausted
+                        std::uint64_t allocate()
+                        {
+                                std::uint64_t top = header->free_top.load();
+                                while(index_of(top) != 0)
+                                {
+                                        const std::uint64_t next = index_of(node(top).next.load());
+                                        if(header->free_top.compare_exchange_weak(top, pack(next, tag_of(top) + 1))) return index_of(top);
+                                }
+
+                                const std::uint64_t index = header->bump.fetch_add(1) + 1;
+                                return index <= capacity_ + Shards ? index : 0;
+                        }
+
+                        void deallocate(const std::uint64_t index)
+                        {
+                                node_t&       freed = nodes[index - 1];
+                                std::uint64_t top   = header->free_top.load();
+                                do relink(freed, index_of(top));
+                                while(!header->free_top.compare_exchange_weak(top, pack(index, tag_of(top) + 1)));
+                        }
+
+                        void initialize()
+                        {
+                                header->magic        = magic;
+                                header->version      = version;
+                                header->shards       = Shards;
+                                header->element_size = sizeof(DataType);
+                                header->capacity     = capacity_;
+                                header->free_top.store(0);
+                                header->bump.store(0);
+                                for(shard_t& shard: header->shard)
+                                {
+                                        const std::uint64_t dummy = allocate();
+                                        relink(nodes[dummy - 1], 0);
+                                        shard.head.store(pack(dummy, 0));
+                                        shard.tail.store(pack(dummy, 0));
+                                        shard.inserted.store(0);
+                                        shard.extracted.store(0);
+                                }
+                        }
+
+                        bool compatible() const
+                        {
+                                return header->magic == magic && header->version == version && header->shards == Shards && header->element_size == sizeof(DataType) && header->capacity == capacity_;
+                        }
+
+                        // Exactly one process initializes an empty region, every other one waits until it is ready
+                        void attach(const int fd)
+                        {
+                                struct stat status {};
+                                if(fstat(fd, &status) != 0) throw std::logic_error("Could not inspect shared region\n");
+                                if(status.st_size == 0 && ftruncate(fd, static_cast<off_t>(region_size)) != 0) throw std::logic_error("Could not size shared region\n");
+                                if(status.st_size != 0 && static_cast<std::size_t>(status.st_size) != region_size) throw std::logic_error("Shared region has a different layout\n");
+
+                                void* const region = mmap(nullptr, region_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                                if(region == MAP_FAILED) throw std::logic_error("Could not map shared region\n");
+                                header = static_cast<header_t*>(region);
+                                nodes  = reinterpret_cast<node_t*>(static_cast<std::byte*>(region) + sizeof(header_t));
+
+                                std::uint32_t state = state_empty;
+                                if(header->state.compare_exchange_strong(state, state_creating))
+                                {
+                                        initialize();
+                                        header->state.store(state_ready, std::memory_order_release);
+                                }
+
+                                const auto deadline = std::chrono::steady_clock::now() + creation_timeout;
+                                while(header->state.load(std::memory_order_acquire) != state_ready)
+                                {
+                                        if(std::chrono::steady_clock::now() > deadline) detach_and_throw("Shared region was never initialized\n");
+                                        std::this_thread::yield();
+                                }
+                                if(!compatible()) detach_and_throw("Shared region has a different layout\n");
+                        }
+
+                        [[noreturn]] void detach_and_throw(const char* const message)
+                        {
+                                munmap(header, region_size);
+                                header = nullptr;
+                                throw std::logic_error(message);
+                        }
+
+                        // Threads of all processes spread over the shards by the address of a thread local and their process id
+                        static std::size_t home_shard()
+                        {
+                                static thread_local const std::size_t home = ((reinterpret_cast<std::uintptr_t>(&home) >> 6) ^ static_cast<std::size_t>(getpid())) % Shards;
+                                return home;
+                        }
+
+                        bool enqueue(shard_t& shard, const DataType& data)
+                        {
+                                const std::uint64_t index = allocate();
+                                if(index == 0) return false;
+                                node_t& fresh = nodes[index - 1];
+                                store(fresh, data);
+                                relink(fresh, 0);
+
+                                std::uint64_t tail = 0;
+                                while(true)
+                                {
+                                        tail               = shard.tail.load();
+                                        std::uint64_t next = node(tail).next.load();
+                                        if(tail != shard.tail.load()) continue;
+
+                                        if(index_of(next) == 0)
+                                        {
+                                                if(node(tail).next.compare_exchange_weak(next, pack(index, tag_of(next) + 1))) break;
+                                        }
+                                        else // Move the tail forward
+                                                shard.tail.compare_exchange_weak(tail, pack(index_of(next), tag_of(tail) + 1));
+                                }
+                                shard.tail.compare_exchange_strong(tail, pack(index, tag_of(tail) + 1));
+                                shard.inserted.fetch_add(1);
+                                return true;
+                        }
+
+                        // The value is read before the head moves, afterwards the node may already be recycled by another process
+                        std::optional<DataType> dequeue(shard_t& shard)
+                        {
+                                std::uint64_t           head = 0;
+                                std::optional<DataType> data;
+                                while(true)
+                                {
+                                        head                     = shard.head.load();
+                                        std::uint64_t       tail = shard.tail.load();
+                                        const std::uint64_t next = node(head).next.load();
+                                        if(head != shard.head.load()) continue;
+
+                                        if(index_of(head) == index_of(tail))
+                                        {
+                                                if(index_of(next) == 0) return {}; // Shard is empty
+                                                shard.tail.compare_exchange_weak(tail, pack(index_of(next), tag_of(tail) + 1));
+                                                continue;
+                                        }
+
+                                        data = load(node(next));
+                                        if(shard.head.compare_exchange_weak(head, pack(index_of(next), tag_of(head) + 1))) break;
+                                }
+                                shard.extracted.fetch_add(1);
+                                deallocate(index_of(head));
+                                return data;
+                        }
+
+                public:
+                        using value_type = DataType;
+
+                        static constexpr std::size_t default_capacity = 1 << 16;
+
+                        // Opens or creates the file at path and attaches to its contents. A POSIX shared memory object is reachable as /dev/shm/<name>.
+                        explicit SharedBag(const std::string& path, const std::size_t capacity = default_capacity): capacity_(capacity), region_size(size_for(capacity))
+                        {
+                                if(capacity == 0 || capacity + Shards > index_mask) throw std::logic_error("Unsupported capacity\n");
+                                const int fd = open(path.c_str(), O_RDWR | O_CREAT, 0600);
+                                if(fd < 0) throw std::logic_error("Could not open shared region\n");
+                                try
+                                {
+                                        attach(fd);
+                                }
+                                catch(...)
+                                {
+                                        close(fd);
+                                        throw;
+                                }
+                                close(fd);
+                        }
+
+                        // Attaches to an already open descriptor, e.g. from memfd_create or shm_open, which stays owned by the caller
+                        SharedBag(const int fd, const std::size_t capacity): capacity_(capacity), region_size(size_for(capacity))
+                        {
+                                if(capacity == 0 || capacity + Shards > index_mask) throw std::logic_error("Unsupported capacity\n");
+                                attach(fd);
+                        }
+
+                        SharedBag(const SharedBag&)            = delete;
+                        SharedBag& operator=(const SharedBag&) = delete;
+
+                        std::size_t capacity() const
+                        {
+                                return capacity_;
+                        }
+
+                        void insert(const DataType& element)
+                        {
+                                if(!try_insert(element)) throw std::logic_error("Could not insert object\n");
+                        }
+
+                        // Fails once every node of the arena holds an element
+                        bool try_insert(const DataType& element)
+                        {
+                                return enqueue(header->shard[home_shard()], element);
+                        }
+
+                        // Skips shards whose counters balance. Should all of them balance, every shard is probed once more without looking at the
+                        // counters, since elements of a process that died before counting them are not reflected there.
+                        std::optional<DataType> extract()
+                        {
+                                const std::size_t home      = home_shard();
+                                bool              all_empty = true;
+                                for(std::size_t i = 0; i < Shards; i++)
+                                {
+                                        shard_t& shard = header->shard[(home + i) % Shards];
+                                        if(shard.inserted.load(std::memory_order_relaxed) <= shard.extracted.load(std::memory_order_relaxed)) continue;
+
+                                        all_empty                       = false;
+                                        std::optional<DataType> element = dequeue(shard);
+                                        if(element) return element;
+                                }
+                                if(!all_empty) return {};
+
+                                for(std::size_t i = 0; i < Shards; i++)
+                                {
+                                        std::optional<DataType> element = dequeue(header->shard[(home + i) % Shards]);
+                                        if(element) return element;
+                                }
+                                return {};
+                        }
+
+                        // Relaxed sum over the shard counters of all processes, cheap but only exact when nobody modifies the bag
+                        std::size_t size_approx() const
+                        {
+                                std::int64_t total = 0;
+                                for(const shard_t& shard: header->shard) total += shard.inserted.load(std::memory_order_relaxed) - shard.extracted.load(std::memory_order_relaxed);
+                                return total > 0 ? static_cast<std::size_t>(total) : 0;
+                        }
+
+                        // Exact snapshot, rescans the shard counters until two consecutive scans agree and falls back to size_approx after
+                        // size_scans scans like WaitFreeBag::size
+                        std::size_t size() const
+                        {
+                                std::int64_t inserted  = -1;
+                                std::int64_t extracted = -1;
+                                for(std::size_t scan = 0; scan < size_scans; scan++)
+                                {
+                                        std::int64_t current_inserted  = 0;
+                                        std::int64_t current_extracted = 0;
+                                        for(const shard_t& shard: header->shard)
+                                        {
+                                                current_inserted += shard.inserted.load(std::memory_order_acquire);
+                                                current_extracted += shard.extracted.load(std::memory_order_acquire);
+                                        }
+                                        if(current_inserted == inserted && current_extracted == extracted)
+                                        {
+                                                const std::int64_t total = inserted - extracted;
+                                                return total > 0 ? static_cast<std::size_t>(total) : 0;
+                                        }
+                                        inserted  = current_inserted;
+                                        extracted = current_extracted;
+                                }
+                                return size_approx();
+                        }
+
+                        // Elements are copied out, passed to f and written back, so f must not run concurrently with extracts of any process
+                        template<typename Func>
+                                requires invokable<Func, DataType>
+                        void for_all(Func f)
+                        {
+                                for(shard_t& shard: header->shard)
+                                {
+                                        const std::uint64_t tail = index_of(shard.tail.load());
+                                        for(std::uint64_t index = index_of(shard.head.load()); index != tail;)
+                                        {
+                                                index          = index_of(nodes[index - 1].next.load());
+                                                node_t&  added = nodes[index - 1];
+                                                DataType data  = load(added);
+                                                f(data);
+                                                store(added, data);
+                                        }
+                                }
+                        }
+
+                        // Only unmaps the region, the contents stay in the backing object for the next process to attach
+                        ~SharedBag()
+                        {
+                                if(header) munmap(header, region_size);
+                        }
+        };
+} // namespace wait_free_bag
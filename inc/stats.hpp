@@ -0,0 +1,209 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace wait_free_bag
+{
+        // Hot path instrumentation, compiled in with -DWAIT_FREE_BAG_STATS. Without it the counters are empty members and every update is a
+        // no-op the compiler removes.
+#if defined(WAIT_FREE_BAG_STATS)
+        inline constexpr bool stats_enabled = true;
+#else
+        inline constexpr bool stats_enabled = false;
+#endif
+
+        enum class event_t : std::size_t
+        {
+                cas_attempts,
+                cas_failures,
+                loop_iterations,
+                tail_helps,
+                empty_probes,
+                extracts,
+                count
+        };
+
+        // Snapshot of the counters of one shard. Occupancy is derived from the element counters of the bag and is exact even without
+        // instrumentation.
+        struct shard_stats_t
+        {
+                public:
+                        std::uint64_t      cas_attempts    = 0;
+                        std::uint64_t      cas_failures    = 0;
+                        std::uint64_t      loop_iterations = 0;
+                        std::uint64_t      tail_helps      = 0;
+                        std::uint64_t      empty_probes    = 0;
+                        std::int_least64_t occupancy       = 0;
+
+                        shard_stats_t& operator+=(const shard_stats_t& other)
+                        {
+                                cas_attempts += other.cas_attempts;
+                                cas_failures += other.cas_failures;
+                                loop_iterations += other.loop_iterations;
+                                tail_helps += other.tail_helps;
+                                empty_probes += other.empty_probes;
+                                occupancy += other.occupancy;
+                                return *this;
+                        }
+        };
+
+        struct bag_stats_t
+        {
+                public:
+                        bool                       enabled       = stats_enabled;
+                        std::size_t                active_shards = 0;
+                        std::size_t                numa_nodes    = 1;
+                        std::uint64_t              extracts      = 0;
+                        shard_stats_t              total;
+                        std::vector<shard_stats_t> shards;
+        };
+
+        // Event counters of one object. Every thread that touches the object gets its own cache line of counters which only it writes,
+        // reads sum up all lines. Threads find their line through a small direct mapped cache keyed by object ids that are never reused, a
+        // miss searches the lines of the object for one that belongs to the thread. Lines live as long as the object.
+        template<bool Enabled = stats_enabled>
+        class EventCounters
+        {
+                public:
+                        void add(event_t, std::uint64_t = 1) {}
+
+                        std::uint64_t load(event_t) const
+                        {
+                                return 0;
+                        }
+        };
+
+        template<>
+        class EventCounters<true>
+        {
+                private:
+                        static constexpr std::size_t cache_size = 64;
+
+                        struct alignas(64) line_t
+                        {
+                                public:
+                                        std::array<std::atomic_uint64_t, static_cast<std::size_t>(event_t::count)> counts {};
+                                        const void*                                                                owner = nullptr;
+                                        line_t*                                                                    next  = nullptr;
+                        };
+
+                        struct cached_t
+                        {
+                                public:
+                                        std::uint64_t id   = 0;
+                                        line_t*       line = nullptr;
+                        };
+
+                        static inline std::atomic_uint64_t next_id = 1;
+
+                        const std::uint64_t  id    = next_id.fetch_add(1);
+                        std::atomic<line_t*> lines = nullptr;
+
+                        static std::array<cached_t, cache_size>& cache()
+                        {
+                                static thread_local std::array<cached_t, cache_size> entries {};
+                                return entries;
+                        }
+
+                        // The address of the thread local cache identifies the thread, a later thread reusing the address adopts the line
+                        line_t& local()
+                        {
+                                std::array<cached_t, cache_size>& entries = cache();
+                                cached_t&                         cached  = entries[id % cache_size];
+                                if(cached.id == id) [[likely]]
+                                        return *cached.line;
+
+                                const void* const owner = &entries;
+                                line_t*           line  = lines.load(std::memory_order_acquire);
+                                while(line && line->owner != owner) line = line->next;
+                                if(line == nullptr)
+                                {
+                                        line        = new line_t();
+                                        line->owner = owner;
+                                        line->next  = lines.load(std::memory_order_relaxed);
+                                        while(!lines.compare_exchange_weak(line->next, line, std::memory_order_release, std::memory_order_relaxed));
+                                }
+
+                                cached = {id, line};
+                                return *line;
+                        }
+
+                public:
+                        EventCounters() = default;
+
+                        EventCounters(const EventCounters&)            = delete;
+                        EventCounters& operator=(const EventCounters&) = delete;
+
+                        // Only the owner writes its line, so a plain load and store is enough
+                        void add(const event_t event, const std::uint64_t count = 1)
+                        {
+                                std::atomic_uint64_t& counter = local().counts[static_cast<std::size_t>(event)];
+                                counter.store(counter.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+                        }
+
+                        std::uint64_t load(const event_t event) const
+                        {
+                                std::uint64_t total = 0;
+                                for(const line_t* line = lines.load(std::memory_order_acquire); line; line = line->next) total += line->counts[static_cast<std::size_t>(event)].load(std::memory_order_relaxed);
+                                return total;
+                        }
+
+                        ~EventCounters()
+                        {
+                                line_t* line = lines.load();
+                                while(line)
+                                {
+                                        line_t* const next = line->next;
+                                        delete line;
+                                        line = next;
+                                }
+                        }
+        };
+
+        // Fills the shard counters of a snapshot from events recorded by the shard itself
+        inline shard_stats_t shard_events(const EventCounters<>& events)
+        {
+                shard_stats_t stats;
+                stats.cas_attempts    = events.load(event_t::cas_attempts);
+                stats.cas_failures    = events.load(event_t::cas_failures);
+                stats.loop_iterations = events.load(event_t::loop_iterations);
+                stats.tail_helps      = events.load(event_t::tail_helps);
+                return stats;
+        }
+
+        // Event counters of a CAS based shard together with the number of CAS races it lost. Adaptive bags read the lost races even without
+        // instrumentation, so that count is always kept. It sits on its own cache line and is only written on failure, which keeps it out of
+        // the way of uncontended operations.
+        class ShardEvents
+        {
+                private:
+                        alignas(64) std::atomic_size_t failed_cas = 0;
+                        [[no_unique_address]] EventCounters<> counters;
+
+                public:
+                        void add(const event_t event, const std::uint64_t count = 1)
+                        {
+                                counters.add(event, count);
+                        }
+
+                        void contended()
+                        {
+                                failed_cas.fetch_add(1, std::memory_order_relaxed);
+                                counters.add(event_t::cas_failures);
+                        }
+
+                        std::size_t contention() const
+                        {
+                                return failed_cas.load(std::memory_order_relaxed);
+                        }
+
+                        shard_stats_t snapshot() const
+                        {
+                                return shard_events(counters);
+                        }
+        };
+} // namespace wait_free_bag
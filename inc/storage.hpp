@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+
+namespace wait_free_bag
+{
+        // Uninitialized storage for a single value inside nodes and segments. The container decides when the value is constructed and
+        // destroyed, so DataType needs neither a default constructor nor a copy constructor and dummy nodes hold no value at all.
+        template<typename T>
+        class storage_t
+        {
+                private:
+                        alignas(T) std::byte bytes[sizeof(T)];
+
+                public:
+                        template<typename... Args>
+                        void construct(Args&&... args)
+                        {
+                                std::construct_at(&get(), std::forward<Args>(args)...);
+                        }
+
+                        void destroy()
+                        {
+                                std::destroy_at(&get());
+                        }
+
+                        // Moves the value out and ends its lifetime
+                        T take()
+                        {
+                                T value = std::move(get());
+                                destroy();
+                                return value;
+                        }
+
+                        T& get()
+                        {
+                                return *std::launder(reinterpret_cast<T*>(bytes));
+                        }
+
+                        const T& get() const
+                        {
+                                return *std::launder(reinterpret_cast<const T*>(bytes));
+                        }
+        };
+} // namespace wait_free_bag
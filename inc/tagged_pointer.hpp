@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace wait_free_bag
+{
+        // Tagged pointers pair a pointer with a modification counter. compare_exchange bumps the counter on every successful update, so a
+        // location that went from A to B and back to A no longer compares equal to a copy read before. Both representations share the
+        // interface load(), store(ptr), compare_exchange(expected, ptr) and representable(ptr).
+        template<typename T>
+        struct tagged_ptr_t
+        {
+                public:
+                        T*            ptr = nullptr;
+                        std::uint64_t tag = 0;
+
+                        bool operator==(const tagged_ptr_t&) const = default;
+        };
+
+        // Packs a 16-bit counter into the upper bits of a 48-bit address and updates both with a plain 64-bit CAS. Addresses above 48 bits
+        // cannot be represented and the counter wraps after 65536 updates.
+        template<typename T>
+        class PackedTaggedPointer
+        {
+                private:
+                        static constexpr std::uint64_t address_bits = 48;
+                        static constexpr std::uint64_t address_mask = (1ULL << address_bits) - 1;
+                        static constexpr std::uint64_t tag_mask     = (1ULL << (64 - address_bits)) - 1;
+
+                        std::atomic_uint64_t value = 0;
+
+                        static std::uint64_t pack(const tagged_ptr_t<T> pointer)
+                        {
+                                return (pointer.tag << address_bits) | reinterpret_cast<std::uintptr_t>(pointer.ptr);
+                        }
+
+                        static tagged_ptr_t<T> unpack(const std::uint64_t packed)
+                        {
+                                return {reinterpret_cast<T*>(packed & address_mask), packed >> address_bits};
+                        }
+
+                public:
+                        static bool representable(const T* const ptr)
+                        {
+                                return (reinterpret_cast<std::uintptr_t>(ptr) & ~address_mask) == 0;
+                        }
+
+                        tagged_ptr_t<T> load() const
+                        {
+                                return unpack(value.load());
+                        }
+
+                        void store(T* const ptr)
+                        {
+                                value.store(pack({ptr, 0}));
+                        }
+
+                        // Installs ptr with the next tag if the location still holds expected, otherwise expected receives the current value
+                        bool compare_exchange(tagged_ptr_t<T>& expected, T* const ptr)
+                        {
+                                std::uint64_t current = pack(expected);
+                                if(value.compare_exchange_strong(current, pack({ptr, (expected.tag + 1) & tag_mask}))) return true;
+                                expected = unpack(current);
+                                return false;
+                        }
+        };
+
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16)
+        // Ref: https://www.felixcloutier.com/x86/cmpxchg8b:cmpxchg16b
+        // Full pointer and 64-bit counter updated together with a double width CAS, any address is representable. Loads read the two halves
+        // separately and retry until the counter is stable: every update changes the counter, so a stable counter implies a consistent
+        // pointer and loads never have to write the cache line.
+        template<typename T>
+        class WideTaggedPointer
+        {
+                private:
+                        __extension__ typedef unsigned __int128 pair_t;
+                        typedef std::uint64_t word_t __attribute__((may_alias));
+
+                        alignas(16) pair_t value = 0;
+
+                        static pair_t pack(const tagged_ptr_t<T> pointer)
+                        {
+                                return (static_cast<pair_t>(pointer.tag) << 64) | reinterpret_cast<std::uintptr_t>(pointer.ptr);
+                        }
+
+                        static tagged_ptr_t<T> unpack(const pair_t pair)
+                        {
+                                return {reinterpret_cast<T*>(static_cast<std::uintptr_t>(pair)), static_cast<std::uint64_t>(pair >> 64)};
+                        }
+
+                public:
+                        static bool representable(const T* const)
+                        {
+                                return true;
+                        }
+
+                        tagged_ptr_t<T> load() const
+                        {
+                                const word_t* const words = reinterpret_cast<const word_t*>(&value);
+                                while(true)
+                                {
+                                        const std::uint64_t tag = __atomic_load_n(&words[1], __ATOMIC_SEQ_CST);
+                                        const std::uint64_t ptr = __atomic_load_n(&words[0], __ATOMIC_SEQ_CST);
+                                        if(__atomic_load_n(&words[1], __ATOMIC_SEQ_CST) == tag) return {reinterpret_cast<T*>(ptr), tag};
+                                }
+                        }
+
+                        // Only valid before the location is shared, concurrent loads rely on the tag never going back
+                        void store(T* const ptr)
+                        {
+                                value = pack({ptr, 0});
+                        }
+
+                        bool compare_exchange(tagged_ptr_t<T>& expected, T* const ptr)
+                        {
+                                const pair_t current  = pack(expected);
+                                const pair_t previous = __sync_val_compare_and_swap(&value, current, pack({ptr, expected.tag + 1}));
+                                if(previous == current) return true;
+                                expected = unpack(previous);
+                                return false;
+                        }
+        };
+
+        template<typename T>
+        using DefaultTaggedPointer = WideTaggedPointer<T>;
+#else
+        template<typename T>
+        using DefaultTaggedPointer = PackedTaggedPointer<T>;
+#endif
+} // namespace wait_free_bag
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace wait_free_bag
+{
+        // Ref: https://www.jstatsoft.org/article/view/v008i14
+        // One xorshift step on a per-thread state, cheap enough to pick a victim or a slot on every operation. A zero state is seeded from
+        // its own address first, so states of different threads start apart.
+        inline std::uint64_t xorshift(std::uint64_t& state)
+        {
+                if(state == 0) state = reinterpret_cast<std::uintptr_t>(&state) | 1;
+                state ^= state << 13;
+                state ^= state >> 7;
+                state ^= state << 17;
+                return state;
+        }
+
+        // Process wide list of per-thread records of type Record.
+        // A thread claims a record on first use and hands it back when it exits so that the next thread can adopt it together with whatever
+        // state (free lists, retired nodes, ...) it still holds. If Record has a release() member it is called on the owning thread right
+        // before the record is handed back. Registries are never destroyed: records of one registry free memory owned by another, so tearing
+        // them down at exit in an unspecified order would be unsafe. Everything stays reachable, which keeps leak checkers quiet.
+        template<typename Record>
+        class ThreadRegistry
+        {
+                private:
+                        struct entry_t
+                        {
+                                public:
+                                        Record           record;
+                                        entry_t*         next   = nullptr;
+                                        std::atomic_bool in_use = true;
+                        };
+
+                        struct handle_t
+                        {
+                                public:
+                                        entry_t* const entry;
+
+                                        handle_t(): entry(instance().acquire())
+                                        {
+                                                cached = entry;
+                                        }
+
+                                        ~handle_t()
+                                        {
+                                                if constexpr(requires(Record& record) { record.release(); }) entry->record.release();
+                                                cached = nullptr;
+                                                exited = true;
+                                                entry->in_use.store(false, std::memory_order_release);
+                                        }
+                        };
+
+                        static inline thread_local entry_t* cached = nullptr;
+                        static inline thread_local bool     exited = false;
+
+                        std::atomic<entry_t*>    entries = nullptr;
+                        std::atomic<std::size_t> count   = 0;
+
+                        entry_t* acquire()
+                        {
+                                for(entry_t* entry = entries.load(std::memory_order_acquire); entry; entry = entry->next)
+                                {
+                                        bool expected = false;
+                                        if(!entry->in_use.load(std::memory_order_relaxed) && entry->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+                                                return entry;
+                                }
+
+                                entry_t* const entry = new entry_t();
+                                entry->next          = entries.load(std::memory_order_relaxed);
+                                while(!entries.compare_exchange_weak(entry->next, entry, std::memory_order_release, std::memory_order_relaxed));
+                                count.fetch_add(1, std::memory_order_relaxed);
+                                return entry;
+                        }
+
+                        ThreadRegistry() = default;
+
+                public:
+                        ThreadRegistry(const ThreadRegistry&)            = delete;
+                        ThreadRegistry& operator=(const ThreadRegistry&) = delete;
+
+                        static ThreadRegistry& instance()
+                        {
+                                static ThreadRegistry* const registry = new ThreadRegistry();
+                                return *registry;
+                        }
+
+                        // Record owned by the calling thread
+                        static Record& local()
+                        {
+                                if(cached) [[likely]]
+                                        return cached->record;
+
+                                if(exited)
+                                {
+                                        // The thread is being torn down, keep the record for good instead of handing it back
+                                        cached = instance().acquire();
+                                        return cached->record;
+                                }
+
+                                thread_local handle_t handle;
+                                return handle.entry->record;
+                        }
+
+                        template<typename Func>
+                        void for_each(Func f)
+                        {
+                                for(entry_t* entry = entries.load(std::memory_order_acquire); entry; entry = entry->next) f(entry->record);
+                        }
+
+                        std::size_t size() const
+                        {
+                                return count.load(std::memory_order_relaxed);
+                        }
+        };
+} // namespace wait_free_bag
@@ -0,0 +1,330 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <concepts.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <node_pool.hpp>
+#include <optional>
+#include <reclamation.hpp>
+#include <stats.hpp>
+#include <stdexcept>
+#include <storage.hpp>
+#include <tagged_pointer.hpp>
+#include <thread_registry.hpp>
+#include <type_traits>
+#include <utility>
+
+namespace wait_free_bag
+{
+        // Ref: https://dominoweb.draco.res.ibm.com/58319a2ed2b1078985257003004617ef.html
+        // Ref: https://people.csail.mit.edu/shanir/publications/Lock_Free.pdf
+        // Lock-free LIFO shard, the element a thread inserted last is the first one it gets back while it is still in its cache. The top is
+        // a tagged pointer (see tagged_pointer.hpp). An operation that loses the race on the top backs off into the elimination array, where a
+        // push and a pop that meet in the same slot hand the node over without touching the top at all.
+        template<typename DataType, template<typename> class Allocator = NodePool, typename Reclaimer = HazardPointers, template<typename> class TaggedPointer = DefaultTaggedPointer, std::size_t Slots = 8>
+        class TreiberStack
+        {
+                private:
+                        static_assert(Slots > 0, "The elimination array needs at least one slot");
+
+                        static constexpr std::size_t elimination_spins = 32;
+
+                        struct node_t
+                        {
+                                public:
+                                        storage_t<DataType>  data;
+                                        std::atomic<node_t*> next = nullptr;
+                        };
+
+                        // A slot belongs to the push that placed its node there until that push clears it again. A pop takes the node by
+                        // replacing it with the taken marker, so the same node can never show up twice while its push is still waiting.
+                        struct alignas(64) exchanger_t
+                        {
+                                public:
+                                        std::atomic<node_t*> node = nullptr;
+                        };
+
+                        using pointer_t = tagged_ptr_t<node_t>;
+                        using nodes     = NodeLifecycle<node_t, Allocator>;
+
+                        static inline node_t taken {};
+
+                        alignas(64) TaggedPointer<node_t> top;
+                        alignas(64) ShardEvents           events;
+                        std::array<exchanger_t, Slots>    exchangers;
+
+                        static node_t* strip(const pointer_t pointer)
+                        {
+                                return pointer.ptr;
+                        }
+
+                        // Spreads the operations that back off over the elimination array
+                        static exchanger_t& random_exchanger(std::array<exchanger_t, Slots>& array)
+                        {
+                                static thread_local std::uint64_t random = 0;
+                                return array[xorshift(random) % Slots];
+                        }
+
+                        // Offers node to a concurrent pop for a short while, returns true if one took it
+                        bool eliminate_push(node_t* const node)
+                        {
+                                exchanger_t& exchanger = random_exchanger(exchangers);
+                                node_t*      expected  = nullptr;
+                                if(!exchanger.node.compare_exchange_strong(expected, node, std::memory_order_release, std::memory_order_relaxed)) return false;
+
+                                for(std::size_t spin = 0; spin < elimination_spins; spin++)
+                                {
+                                        if(exchanger.node.load(std::memory_order_relaxed) == &taken) break;
+                                }
+
+                                expected = node;
+                                if(exchanger.node.compare_exchange_strong(expected, nullptr, std::memory_order_relaxed)) return false;
+
+                                // A pop replaced the node with the taken marker and owns it now
+                                exchanger.node.store(nullptr, std::memory_order_relaxed);
+                                return true;
+                        }
+
+                        // Takes a node a concurrent push offered, the node never was on the stack, so nobody else can still be reading it
+                        node_t* eliminate_pop()
+                        {
+                                exchanger_t& exchanger = random_exchanger(exchangers);
+                                node_t*      node      = exchanger.node.load(std::memory_order_relaxed);
+                                if(node == nullptr || node == &taken) return nullptr;
+                                if(!exchanger.node.compare_exchange_strong(node, &taken, std::memory_order_acquire, std::memory_order_relaxed)) return nullptr;
+                                return node;
+                        }
+
+                        // Publishes the private chain first..last with a single CAS on the top, or hands a single node to a pop
+                        void push(node_t* const first, node_t* const last)
+                        {
+                                pointer_t top_copy = top.load();
+                                while(true)
+                                {
+                                        events.add(event_t::loop_iterations);
+                                        last->next.store(top_copy.ptr, std::memory_order_relaxed);
+                                        events.add(event_t::cas_attempts);
+                                        if(top.compare_exchange(top_copy, first)) return;
+                                        events.contended();
+                                        if(first == last && eliminate_push(first)) return;
+                                        top_copy = top.load();
+                                }
+                        }
+
+                        template<bool Const>
+                        class basic_iterator_t
+                        {
+                                private:
+                                        node_t* node = nullptr;
+
+                                public:
+                                        using iterator_concept  = std::forward_iterator_tag;
+                                        using iterator_category = std::forward_iterator_tag;
+                                        using value_type        = DataType;
+                                        using difference_type   = std::ptrdiff_t;
+                                        using reference         = std::conditional_t<Const, const DataType&, DataType&>;
+                                        using pointer           = std::conditional_t<Const, const DataType*, DataType*>;
+
+                                        basic_iterator_t() = default;
+
+                                        explicit basic_iterator_t(node_t* const node): node(node) {}
+
+                                        reference operator*() const
+                                        {
+                                                return node->data.get();
+                                        }
+
+                                        pointer operator->() const
+                                        {
+                                                return &node->data.get();
+                                        }
+
+                                        basic_iterator_t& operator++()
+                                        {
+                                                node = node->next.load();
+                                                return *this;
+                                        }
+
+                                        basic_iterator_t operator++(int)
+                                        {
+                                                const basic_iterator_t previous = *this;
+                                                ++*this;
+                                                return previous;
+                                        }
+
+                                        bool operator==(const basic_iterator_t&) const = default;
+                        };
+
+                public:
+                        using value_type     = DataType;
+                        using iterator       = basic_iterator_t<false>;
+                        using const_iterator = basic_iterator_t<true>;
+
+                        TreiberStack()
+                        {
+                                top.store(nullptr);
+                        }
+
+                        TreiberStack(const TreiberStack&)            = delete;
+                        TreiberStack& operator=(const TreiberStack&) = delete;
+
+                        bool enqueue(const DataType& data)
+                        {
+                                return emplace(data);
+                        }
+
+                        bool enqueue(DataType&& data)
+                        {
+                                return emplace(std::move(data));
+                        }
+
+                        // Constructs the element inside a fresh node and pushes it, or hands it straight to a pop if the top stays contended
+                        template<typename... Args>
+                        bool emplace(Args&&... args)
+                        {
+                                node_t* const node = nodes::template create_usable<TaggedPointer>();
+                                if(node == nullptr) return false;
+                                try
+                                {
+                                        node->data.construct(std::forward<Args>(args)...);
+                                }
+                                catch(...)
+                                {
+                                        nodes::destroy(node);
+                                        throw;
+                                }
+
+                                push(node, node);
+                                return true;
+                        }
+
+                        // Pops the most recently pushed element
+                        std::optional<DataType> dequeue()
+                        {
+                                typename Reclaimer::guard guard;
+
+                                pointer_t top_copy;
+                                while(true)
+                                {
+                                        events.add(event_t::loop_iterations);
+                                        top_copy = guard.protect(0, top, strip);
+                                        if(top_copy.ptr == nullptr) return {}; // Stack is empty
+
+                                        node_t* const next = top_copy.ptr->next.load();
+                                        events.add(event_t::cas_attempts);
+                                        if(top.compare_exchange(top_copy, next)) break;
+                                        events.contended();
+
+                                        if(node_t* const node = eliminate_pop())
+                                        {
+                                                std::optional<DataType> value = node->data.take();
+                                                nodes::destroy(node);
+                                                return value;
+                                        }
+                                }
+
+                                std::optional<DataType> value = top_copy.ptr->data.take();
+                                Reclaimer::retire(top_copy.ptr, nodes::retire);
+                                return value;
+                        }
+
+                        // Builds a private chain in the order of the range and pushes it with one CAS on the top, so the first element of the
+                        // range ends up on top. Chains never go through the elimination array.
+                        template<std::input_iterator Iterator>
+                        std::size_t enqueue_range(Iterator first, Iterator last)
+                        {
+                                if(first == last) return 0;
+
+                                node_t* const chain_head = nodes::template create_usable<TaggedPointer>();
+                                if(chain_head == nullptr) return 0;
+
+                                // length counts the constructed elements, the chain may end in one more node whose element threw
+                                std::size_t length     = 0;
+                                node_t*     chain_tail = chain_head;
+                                try
+                                {
+                                        chain_head->data.construct(*first);
+                                        length = 1;
+                                        for(++first; first != last; ++first)
+                                        {
+                                                node_t* const node = nodes::template create_usable<TaggedPointer>();
+                                                if(node == nullptr) break;
+                                                chain_tail->next.store(node, std::memory_order_relaxed);
+                                                chain_tail = node;
+                                                node->data.construct(*first);
+                                                length++;
+                                        }
+                                }
+                                catch(...)
+                                {
+                                        nodes::discard_chain(chain_head, length);
+                                        throw;
+                                }
+
+                                push(chain_head, chain_tail);
+                                return length;
+                        }
+
+                        template<typename Func>
+                                requires invokable<Func, DataType>
+                        void for_all(Func f)
+                        {
+                                for(node_t* node = top.load().ptr; node; node = node->next.load()) f(node->data.get());
+                        }
+
+                        // Iterators start at the current top, a concurrent pop may retire the node they stand on. Nodes that are exchanged in the
+                        // elimination array never show up.
+                        iterator begin()
+                        {
+                                return iterator(top.load().ptr);
+                        }
+
+                        iterator end()
+                        {
+                                return iterator();
+                        }
+
+                        const_iterator begin() const
+                        {
+                                return const_iterator(top.load().ptr);
+                        }
+
+                        const_iterator end() const
+                        {
+                                return const_iterator();
+                        }
+
+                        // Lost races on the top, each of them is followed by an attempt in the elimination array
+                        std::size_t contention() const
+                        {
+                                return events.contention();
+                        }
+
+                        // CAS counts cover the CAS on the top only, exchanges in the elimination array are not counted
+                        shard_stats_t stats() const
+                        {
+                                return events.snapshot();
+                        }
+
+                        // Preallocates nodes for the calling thread so that its next count pushes do not hit the system allocator
+                        static void reserve(std::size_t count)
+                        {
+                                Allocator<node_t>::reserve(count);
+                        }
+
+                        ~TreiberStack()
+                        {
+                                node_t* node = top.load().ptr;
+                                while(node)
+                                {
+                                        node_t* const next = node->next.load();
+                                        node->data.destroy();
+                                        nodes::destroy(node);
+                                        node = next;
+                                }
+                        }
+        };
+} // namespace wait_free_bag
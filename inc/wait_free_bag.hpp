@@ -1,40 +1,117 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <atomic>
+#include <bounded_ring.hpp>
+#include <chrono>
+#include <concepts>
+#include <concepts.hpp>
+#include <coroutine>
+#include <cstdint>
+#include <helping_queue.hpp>
+#include <iterator>
+#include <latch>
+#include <linked_iterator.hpp>
+#include <memory>
+#include <mutex>
+#include <node_pool.hpp>
+#include <numa.hpp>
 #include <omp.h>
 #include <optional>
+#include <reclamation.hpp>
+#include <segmented_queue.hpp>
+#include <semaphore>
+#include <shared_bag.hpp>
+#include <stats.hpp>
 #include <stdexcept>
+#include <storage.hpp>
+#include <tagged_pointer.hpp>
 #include <thread>
+#include <thread_registry.hpp>
+#include <treiber_stack.hpp>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <work_stealing_deque.hpp>
 
 namespace wait_free_bag
 {
-        template<typename Func, typename DataType>
-        concept invokable = requires(Func foo, DataType elem) { foo(std::ref(elem)); };
-
         // Ref: https://www.cs.rochester.edu/~scott/papers/1996_PODC_queues.pdf
-        template<typename DataType>
+        // Head and tail are tagged pointers (see tagged_pointer.hpp), the links between nodes are plain pointers.
+        template<typename DataType, template<typename> class Allocator = NodePool, typename Reclaimer = HazardPointers, template<typename> class TaggedPointer = DefaultTaggedPointer>
         class WaitFreeQueue
         {
                 private:
                         struct node_t
                         {
                                 public:
-                                        DataType             data;
+                                        storage_t<DataType>  data;
                                         std::atomic<node_t*> next;
                         };
 
-                        std::atomic<node_t*> head;
-                        std::atomic<node_t*> tail;
+                        using pointer_t = tagged_ptr_t<node_t>;
+                        using nodes     = NodeLifecycle<node_t, Allocator>;
+
+                        alignas(64) TaggedPointer<node_t> head;
+                        alignas(64) TaggedPointer<node_t> tail;
+                        alignas(64) ShardEvents           events;
+
+                        static node_t* strip(const pointer_t pointer)
+                        {
+                                return pointer.ptr;
+                        }
+
+                        // Links the private chain first..last behind the current last node and tries to move the tail onto last
+                        void link(node_t* const first, node_t* const last)
+                        {
+                                typename Reclaimer::guard guard;
+
+                                pointer_t tail_copy;
+                                while(true)
+                                {
+                                        events.add(event_t::loop_iterations);
+                                        tail_copy    = guard.protect(0, tail, strip);
+                                        node_t* next = tail_copy.ptr->next.load();
+                                        if(tail.load() != tail_copy) continue;
 
-                        const std::size_t mask = 0x0000ffffffffffff;
+                                        if(next == nullptr)
+                                        {
+                                                events.add(event_t::cas_attempts);
+                                                if(tail_copy.ptr->next.compare_exchange_weak(next, first)) break;
+                                                events.contended();
+                                        }
+                                        else // Move the tail forward
+                                        {
+                                                events.add(event_t::tail_helps);
+                                                tail.compare_exchange(tail_copy, next);
+                                        }
+                                }
+
+                                // Other threads may already be walking the tail through the chain, in which case this CAS fails. Helpers only move the
+                                // tail by one node, so keep walking it until it reaches the end of the list, otherwise traversals that stop at the tail
+                                // would miss the rest of the chain.
+                                if(tail.compare_exchange(tail_copy, last)) return;
+                                while(true)
+                                {
+                                        tail_copy          = guard.protect(0, tail, strip);
+                                        node_t* const next = tail_copy.ptr->next.load();
+                                        if(next == nullptr) break;
+                                        events.add(event_t::tail_helps);
+                                        tail.compare_exchange(tail_copy, next);
+                                }
+                        }
 
                 public:
+                        using value_type     = DataType;
+                        using iterator       = linked_iterator_t<node_t, false>;
+                        using const_iterator = linked_iterator_t<node_t, true>;
+
                         WaitFreeQueue()
                         {
-                                node_t* const node = new node_t();
-                                if((reinterpret_cast<size_t>(node) & mask) != reinterpret_cast<size_t>(node)) throw std::logic_error("Unexpected pointer value\n");
+                                node_t* const node = nodes::create();
                                 if(node == nullptr) throw std::logic_error("Could not allocate queue\n");
+                                if(!TaggedPointer<node_t>::representable(node)) throw std::logic_error("Unexpected pointer value\n");
 
                                 node->next.store(nullptr);
                                 head.store(node);
@@ -43,170 +120,1336 @@ namespace wait_free_bag
 
                         bool enqueue(const DataType& data)
                         {
-                                // Set up the new node
-                                node_t* const node = new node_t();
-                                if(!node || ((reinterpret_cast<std::size_t>(node) & mask) != reinterpret_cast<std::size_t>(node))) return false;
-                                node->data = std::move(data);
-                                node->next.store(nullptr);
+                                return emplace(data);
+                        }
+
+                        bool enqueue(DataType&& data)
+                        {
+                                return emplace(std::move(data));
+                        }
+
+                        // Constructs the element inside a fresh node and links it behind the last node
+                        template<typename... Args>
+                        bool emplace(Args&&... args)
+                        {
+                                node_t* const node = nodes::template create_usable<TaggedPointer>();
+                                if(node == nullptr) return false;
+                                try
+                                {
+                                        node->data.construct(std::forward<Args>(args)...);
+                                }
+                                catch(...)
+                                {
+                                        nodes::destroy(node);
+                                        throw;
+                                }
+                                node->next.store(nullptr, std::memory_order_relaxed);
+
+                                link(node, node);
+                                return true;
+                        }
 
-                                node_t* tail_copy = nullptr;
+                        std::optional<DataType> dequeue()
+                        {
+                                typename Reclaimer::guard guard;
+
+                                pointer_t head_copy;
+                                node_t*   next = nullptr;
                                 while(true)
                                 {
-                                        tail_copy                   = tail.load();
-                                        node_t* const tail_copy_ptr = reinterpret_cast<node_t*>(reinterpret_cast<std::size_t>(tail_copy) & mask);
-                                        node_t*       next          = (tail_copy_ptr->next).load();
-                                        if(tail.load() == tail_copy)
+                                        events.add(event_t::loop_iterations);
+                                        head_copy           = guard.protect(0, head, strip);
+                                        pointer_t tail_copy = tail.load();
+                                        next                = head_copy.ptr->next.load();
+
+                                        // Next cannot have been retired as long as head has not moved since it was read
+                                        guard.publish(1, next);
+                                        if(head.load() != head_copy) continue;
+
+                                        // Check if the queue is empty or if the tail is lagging behind
+                                        if(head_copy.ptr == tail_copy.ptr)
                                         {
-                                                if((reinterpret_cast<std::size_t>(next) & mask) == 0x0) // Add the new node
-                                                {
-                                                        node_t* const node_ptr = reinterpret_cast<node_t*>(reinterpret_cast<std::size_t>(node) | 0x0001000000000000);
-                                                        if(std::atomic_compare_exchange_weak(&(tail_copy_ptr->next), &next, node_ptr)) break;
-                                                }
-                                                else // Move the tail forward
-                                                {
-                                                        std::size_t count      = (reinterpret_cast<std::size_t>(tail_copy) & mask) >> 48;
-                                                        count                  = (count + 1) & 0x000000000000ffff;
-                                                        count                  = (count << 48) & mask;
-                                                        node_t* const new_tail = reinterpret_cast<node_t*>(reinterpret_cast<std::size_t>(next) | count);
-                                                        std::atomic_compare_exchange_weak(&tail, &tail_copy, new_tail);
-                                                }
+                                                if(next == nullptr) return {}; // Queue is empty
+                                                events.add(event_t::tail_helps);
+                                                tail.compare_exchange(tail_copy, next);
+                                                continue;
                                         }
+
+                                        events.add(event_t::cas_attempts);
+                                        if(head.compare_exchange(head_copy, next)) break;
+                                        events.contended();
                                 }
 
-                                std::size_t count      = (reinterpret_cast<std::size_t>(tail_copy) & mask) >> 48;
-                                count                  = (count + 1) & 0x000000000000ffff;
-                                count                  = (count << 48) & mask;
-                                node_t* const new_tail = reinterpret_cast<node_t*>(reinterpret_cast<std::size_t>(node) | count);
-                                std::atomic_compare_exchange_weak(&tail, &tail_copy, new_tail);
+                                // Next is the new dummy node, only the thread that moved the head onto it may take its data
+                                std::optional<DataType> value = next->data.take();
+                                Reclaimer::retire(head_copy.ptr, nodes::retire);
+                                return value;
+                        }
 
-                                return true;
+                        // Builds a private chain of nodes and links it behind the last node with a single CAS, the tail then moves once for the
+                        // whole chain
+                        template<std::input_iterator Iterator>
+                        std::size_t enqueue_range(Iterator first, Iterator last)
+                        {
+                                if(first == last) return 0;
+
+                                node_t* const chain_head = nodes::template create_usable<TaggedPointer>();
+                                if(chain_head == nullptr) return 0;
+                                chain_head->next.store(nullptr, std::memory_order_relaxed);
+
+                                // Every node is linked into the chain before its element is constructed, so discard_chain finds all of them if a
+                                // copy throws
+                                std::size_t length     = 0;
+                                node_t*     chain_tail = chain_head;
+                                try
+                                {
+                                        chain_head->data.construct(*first);
+                                        length = 1;
+                                        for(++first; first != last; ++first)
+                                        {
+                                                node_t* const node = nodes::template create_usable<TaggedPointer>();
+                                                if(node == nullptr) break;
+                                                node->next.store(nullptr, std::memory_order_relaxed);
+                                                chain_tail->next.store(node, std::memory_order_relaxed);
+                                                chain_tail = node;
+                                                node->data.construct(*first);
+                                                length++;
+                                        }
+                                }
+                                catch(...)
+                                {
+                                        nodes::discard_chain(chain_head, length);
+                                        throw;
+                                }
+
+                                link(chain_head, chain_tail);
+                                return length;
                         }
 
-                        std::optional<DataType> dequeue()
+                        // Detaches up to max_count elements with a single CAS on the head and writes them to out
+                        template<typename OutputIterator>
+                        std::size_t dequeue_n(OutputIterator out, const std::size_t max_count)
                         {
-                                std::optional<DataType> value;
+                                if(max_count == 0) return 0;
 
-                                node_t* head_copy = nullptr;
+                                typename Reclaimer::guard guard;
+
+                                pointer_t   head_copy;
+                                node_t*     next   = nullptr;
+                                node_t*     last   = nullptr;
+                                std::size_t length = 0;
                                 while(true)
                                 {
-                                        head_copy                         = head.load();
-                                        const node_t* const head_copy_ptr = reinterpret_cast<node_t*>(reinterpret_cast<std::size_t>(head_copy) & mask);
-                                        node_t*             tail_copy     = tail.load();
-                                        const node_t* const tail_copy_ptr = reinterpret_cast<node_t*>(reinterpret_cast<std::size_t>(tail_copy) & mask);
-                                        const node_t* const next          = head_copy_ptr->next;
-                                        const node_t* const next_ptr      = reinterpret_cast<node_t*>(reinterpret_cast<std::size_t>(next) & mask);
-                                        if(head_copy == head.load())
+                                        events.add(event_t::loop_iterations);
+                                        head_copy           = guard.protect(0, head, strip);
+                                        pointer_t tail_copy = tail.load();
+                                        next                = head_copy.ptr->next.load();
+
+                                        guard.publish(1, next);
+                                        if(head.load() != head_copy) continue;
+
+                                        // Check if the queue is empty or if the tail is lagging behind
+                                        if(head_copy.ptr == tail_copy.ptr)
                                         {
-                                                // Check if the queue is empty or if the tail is lagging behind
-                                                if(head_copy_ptr == tail_copy_ptr)
+                                                if(next == nullptr) return 0; // Queue is empty
+                                                events.add(event_t::tail_helps);
+                                                tail.compare_exchange(tail_copy, next);
+                                                continue;
+                                        }
+
+                                        // Walk hand over hand, every node is still linked as long as the head has not moved. The head must never overtake
+                                        // the tail, so the walk stops at the node the tail points to.
+                                        last                = next;
+                                        length              = 1;
+                                        std::size_t slot    = 2;
+                                        bool        changed = false;
+                                        while(length < max_count && last != tail.load().ptr)
+                                        {
+                                                node_t* const following = last->next.load();
+                                                if(following == nullptr) break;
+
+                                                guard.publish(slot, following);
+                                                if(head.load() != head_copy)
                                                 {
-                                                        if((reinterpret_cast<std::size_t>(next) & mask) == 0x0) // Queue is empty
-                                                                return {};
-
-                                                        // Advance the tail
-                                                        std::size_t count      = (reinterpret_cast<std::size_t>(tail_copy_ptr) & mask) >> 48;
-                                                        count                  = (count + 1) & 0x000000000000ffff;
-                                                        count                  = (count << 48) & mask;
-                                                        node_t* const new_tail = reinterpret_cast<node_t*>(reinterpret_cast<std::size_t>(next) | count);
-                                                        std::atomic_compare_exchange_weak(&tail, &tail_copy, new_tail);
+                                                        changed = true;
+                                                        break;
                                                 }
+                                                last = following;
+                                                slot = 3 - slot;
+                                                length++;
+                                        }
+                                        if(changed) continue;
 
-                                                value = std::move(next_ptr->data);
+                                        events.add(event_t::cas_attempts);
+                                        if(head.compare_exchange(head_copy, last)) break;
+                                        events.contended();
+                                }
 
-                                                // Advance the head
-                                                std::size_t count      = (reinterpret_cast<std::size_t>(head_copy_ptr) & mask) >> 48;
-                                                count                  = (count + 1) & 0x000000000000ffff;
-                                                count                  = (count << 48) & mask;
-                                                node_t* const new_head = reinterpret_cast<node_t*>(reinterpret_cast<std::size_t>(next) | count);
-                                                if(std::atomic_compare_exchange_weak(&head, &head_copy, new_head)) break;
-                                        }
+                                // Every detached node but the last one is now private, the last one becomes the new dummy node
+                                Reclaimer::retire(head_copy.ptr, nodes::retire);
+                                node_t* iterator = next;
+                                while(true)
+                                {
+                                        *out++ = iterator->data.take();
+                                        if(iterator == last) break;
+
+                                        node_t* const following = iterator->next.load();
+                                        Reclaimer::retire(iterator, nodes::retire);
+                                        iterator = following;
                                 }
 
-                                const node_t* const head_copy_ptr = reinterpret_cast<node_t*>(reinterpret_cast<std::size_t>(head_copy) & mask);
-                                delete head_copy_ptr;
-                                return value;
+                                return length;
                         }
 
                         template<typename Func>
                                 requires invokable<Func, DataType>
                         void for_all(Func f)
                         {
-                                const node_t* const  tail_ptr = reinterpret_cast<node_t*>(reinterpret_cast<std::size_t>(tail.load()) & mask);
-                                std::atomic<node_t*> iterator(head.load());
-                                const node_t*        iterator_ptr = reinterpret_cast<node_t*>(reinterpret_cast<std::size_t>(iterator.load()) & mask);
-                                while(iterator_ptr != tail_ptr)
-                                {
-                                        const node_t* const raw_next_ptr = (iterator_ptr->next).load();
-                                        node_t* const       next_ptr     = reinterpret_cast<node_t*>(reinterpret_cast<std::size_t>(raw_next_ptr) & mask);
+                                const node_t* const tail_ptr = tail.load().ptr;
+                                for(node_t* iterator = head.load().ptr; iterator != tail_ptr; iterator = iterator->next.load()) f(iterator->next.load()->data.get());
+                        }
 
-                                        f(next_ptr->data);
-                                        iterator.store(next_ptr);
-                                        iterator_ptr = reinterpret_cast<node_t*>(reinterpret_cast<std::size_t>(iterator.load()) & mask);
-                                }
+                        // Iterators follow the next pointers from the dummy head to the tail node, a concurrent dequeue may retire the node they
+                        // stand on
+                        iterator begin()
+                        {
+                                return iterator(head.load().ptr);
+                        }
+
+                        iterator end()
+                        {
+                                return iterator(tail.load().ptr);
+                        }
+
+                        const_iterator begin() const
+                        {
+                                return const_iterator(head.load().ptr);
+                        }
+
+                        const_iterator end() const
+                        {
+                                return const_iterator(tail.load().ptr);
+                        }
+
+                        // Lost races on the head and on the last node, read by adaptive bags
+                        std::size_t contention() const
+                        {
+                                return events.contention();
+                        }
+
+                        // CAS counts cover the CAS on the last node and on the head, tail helps count moves of a lagging tail
+                        shard_stats_t stats() const
+                        {
+                                return events.snapshot();
+                        }
+
+                        // Preallocates nodes for the calling thread so that its next count enqueues do not hit the system allocator
+                        static void reserve(std::size_t count)
+                        {
+                                Allocator<node_t>::reserve(count);
                         }
 
                         ~WaitFreeQueue()
                         {
-                                const node_t* const  tail_ptr = reinterpret_cast<node_t*>(reinterpret_cast<std::size_t>(tail.load()) & mask);
-                                std::atomic<node_t*> iterator(head.load());
-                                const node_t*        iterator_ptr = reinterpret_cast<node_t*>(reinterpret_cast<std::size_t>(iterator.load()) & mask);
-                                while(iterator_ptr != tail_ptr)
+                                // Every node but the dummy node still holds its element
+                                for(node_t* node = head.load().ptr->next.load(); node; node = node->next.load()) node->data.destroy();
+
+                                const node_t* iterator = head.load().ptr;
+                                while(iterator)
                                 {
-                                        const node_t* const raw_next_ptr = (iterator_ptr->next).load();
-                                        node_t* const       next_ptr     = reinterpret_cast<node_t*>(reinterpret_cast<std::size_t>(raw_next_ptr) & mask);
+                                        const node_t* const next = iterator->next.load();
+                                        nodes::destroy(iterator);
+                                        iterator = next;
+                                }
+                        }
+        };
 
-                                        delete iterator_ptr;
-                                        iterator.store(next_ptr);
+        // Per-thread state shared by all bags: a small direct mapped cache of the home shard used in each bag, a count of bag operations
+        // and the state of the generator used to pick steal victims. Records outlive their threads and are adopted by new ones (see
+        // ThreadRegistry), which makes them usable as stable owner identities for shard claims.
+        struct bag_thread_record_t
+        {
+                public:
+                        struct home_t
+                        {
+                                public:
+                                        std::uint64_t bag_id = 0;
+                                        std::uint64_t layout = 0;
+                                        std::size_t   ticket = 0;
+                                        std::size_t   shard  = 0;
+                        };
 
-                                        iterator_ptr = reinterpret_cast<node_t*>(reinterpret_cast<std::size_t>(iterator.load()) & mask);
-                                }
+                        static inline std::atomic_uint64_t next_bag_id = 1;
 
-                                delete tail_ptr;
+                        std::array<home_t, 8> homes {};
+                        std::uint64_t         operations = 0;
+                        std::uint64_t         random     = 0;
+
+                        // Picks the first victim when stealing
+                        std::uint64_t next_random()
+                        {
+                                return xorshift(random);
                         }
         };
 
-        template<typename DataType, std::size_t Spread>
+        // Shards that only their owner may push to and pop from, every other thread has to steal
+        template<typename Shard>
+        concept owned_shard = requires(Shard shard) { shard.steal(); };
+
+        // Shards that count the CAS races they lost, required by adaptive bags
+        template<typename Shard>
+        concept contention_reporting_shard = requires(const Shard shard) { shard.contention(); };
+
+        // Shards with hot path instrumentation (see stats.hpp)
+        template<typename Shard>
+        concept stats_reporting_shard = requires(const Shard shard) {
+                { shard.stats() } -> std::same_as<shard_stats_t>;
+        };
+
+        // Spread is the default number of shards, the actual number is chosen at construction. An adaptive bag starts out using all of its
+        // shards as homes and halves or doubles the number of home shards depending on how often the shards report lost CAS races.
+        template<typename DataType, std::size_t Spread, typename Shard = WaitFreeQueue<DataType>>
         class WaitFreeBag
         {
                 private:
-                        std::array<WaitFreeQueue<DataType>, Spread> data;
-                        std::atomic_int_least64_t                   num_elements = 0;
+                        static_assert(std::is_same_v<typename Shard::value_type, DataType>, "Shard must store DataType");
 
-                public:
-                        void insert(DataType element)
+                        using thread_registry_t = ThreadRegistry<bag_thread_record_t>;
+
+                        static constexpr std::size_t steal_rounds   = 4;
+                        static constexpr std::size_t adapt_interval = 1024;
+                        static constexpr std::size_t grow_ratio     = 16;
+                        static constexpr std::size_t shrink_ratio   = 4096;
+                        static constexpr std::size_t calm_to_shrink = 16;
+                        static constexpr std::size_t spin_attempts  = 64;
+                        static constexpr std::size_t chunk_size     = 256;
+                        static constexpr std::size_t size_scans     = 64;
+
+                        // Owned shards only take elements from their owner, threads that find no free shard insert into this shared queue instead
+                        using overflow_t = WaitFreeQueue<DataType>;
+
+                        template<bool Const>
+                        using shard_iterator_t = std::conditional_t<Const, typename Shard::const_iterator, typename Shard::iterator>;
+
+                        template<bool Const>
+                        using overflow_iterator_t = std::conditional_t<Const, typename overflow_t::const_iterator, typename overflow_t::iterator>;
+
+                        // Both counters only ever grow, so two identical scans over all shards prove that nothing changed in between
+                        struct alignas(64) counter_t
                         {
-                                thread_local int idx     = omp_get_thread_num() % Spread;
-                                bool             success = data[idx].enqueue(element);
-                                idx                      = (idx + 1) % Spread;
+                                public:
+                                        std::atomic_int_least64_t inserted  = 0;
+                                        std::atomic_int_least64_t extracted = 0;
+                        };
 
-                                if(!success) throw std::logic_error("Could not insert object\n");
+                        // Everything that belongs to one shard. Slots start on a cache line and the counters get their own line, so producers and
+                        // consumers of neighbouring shards never share one.
+                        struct alignas(64) slot_t
+                        {
+                                public:
+                                        Shard                                   shard;
+                                        counter_t                               counter;
+                                        std::atomic<const bag_thread_record_t*> owner = nullptr;
+                                        [[no_unique_address]] EventCounters<>   events;
+                        };
 
-                                std::atomic_fetch_add(&num_elements, 1);
+                        // Only allocated for owned shards, counted like a shard of its own at index shard_count
+                        struct alignas(64) overflow_slot_t
+                        {
+                                public:
+                                        overflow_t queue;
+                                        counter_t  counter;
+                        };
+
+                        // A consumer that found the bag empty. Producers hand elements over directly and then either resume the coroutine or
+                        // release the semaphore of a blocked thread.
+                        struct waiter_t
+                        {
+                                public:
+                                        std::optional<DataType> value;
+                                        std::coroutine_handle<> handle;
+                                        std::binary_semaphore   ready {0};
+                                        waiter_t*               previous = nullptr;
+                                        waiter_t*               next     = nullptr;
+                                        bool                    queued   = false;
+                        };
+
+                        // Shards of one NUMA node, threads pick their home and steal inside the group of their node first
+                        struct alignas(64) group_t
+                        {
+                                public:
+                                        std::size_t        first   = 0;
+                                        std::size_t        last    = 0;
+                                        std::atomic_size_t tickets = 0;
+                        };
+
+                        const std::size_t                      shard_count;
+                        const std::unique_ptr<slot_t[]>        slots;
+                        const bool                             adaptive;
+                        const std::uint64_t                    id       = bag_thread_record_t::next_bag_id.fetch_add(1);
+                        const NumaTopology&                    topology = NumaTopology::instance();
+                        const std::size_t                      group_count;
+                        const std::unique_ptr<group_t[]>       groups;
+                        const std::unique_ptr<overflow_slot_t> overflow;
+
+                        alignas(64) std::atomic_size_t active;
+                        std::atomic_uint64_t           layout = 0;
+                        [[no_unique_address]] EventCounters<> events;
+
+                        // Unclaimed part of one shard during a parallel traversal, workers advance it by a chunk at a time
+                        template<bool Const>
+                        struct alignas(64) cursor_t
+                        {
+                                public:
+                                        std::atomic_flag        busy;
+                                        shard_iterator_t<Const> position;
+                                        shard_iterator_t<Const> stop;
+                        };
+
+                        // Only touched by the thread that holds adapting
+                        alignas(64) std::atomic_flag adapting;
+                        std::size_t                  last_operations = 0;
+                        std::size_t                  last_failures   = 0;
+                        std::size_t                  calm_windows    = 0;
+
+                        // Parked consumers in FIFO order, the list is only touched when parked is not zero
+                        alignas(64) std::atomic_size_t parked = 0;
+                        std::mutex                     parking_lock;
+                        waiter_t*                      parked_head = nullptr;
+                        waiter_t*                      parked_tail = nullptr;
+
+                        group_t& local_group() const
+                        {
+                                return groups[group_count > 1 ? topology.current_node() : 0];
                         }
 
-                        std::optional<DataType> extract()
+                        // The i-th shard to probe when starting at start: the shards of group first, then all others
+                        std::size_t probe_order(const std::size_t start, const std::size_t i, const group_t& group) const
+                        {
+                                const std::size_t local = group.last - group.first;
+                                if(i < local) return group.first + ((start + i) % local);
+
+                                const std::size_t remote = ((start + i - local) % (shard_count - local));
+                                return remote < group.first ? remote : remote + local;
+                        }
+
+                        // Shards plus the overflow queue of owned bags
+                        std::size_t queue_count() const
+                        {
+                                return overflow ? shard_count + 1 : shard_count;
+                        }
+
+                        counter_t& counter(const std::size_t shard) const
+                        {
+                                return shard == shard_count ? overflow->counter : slots[shard].counter;
+                        }
+
+                        // Every thread picks a home shard the first time it touches the bag. Threads draw tickets and share the active shards of
+                        // the group of their NUMA node round robin, a change of the active count invalidates all cached homes. Every group uses
+                        // its share of the active count. Owned shards cannot be shared at all: threads claim a free shard for good, preferably
+                        // in their own group, and threads that come too late get shard_count back and share the overflow queue.
+                        std::size_t home_shard()
+                        {
+                                bag_thread_record_t&         record = thread_registry_t::local();
+                                bag_thread_record_t::home_t& cached = record.homes[id % record.homes.size()];
+                                if constexpr(owned_shard<Shard>)
+                                {
+                                        if(cached.bag_id == id) [[likely]]
+                                                return cached.shard;
+
+                                        const group_t& group = local_group();
+                                        std::size_t    shard = shard_count;
+                                        for(std::size_t i = 0; i < shard_count && shard == shard_count; i++)
+                                        {
+                                                if(slots[i].owner.load(std::memory_order_acquire) == &record) shard = i;
+                                        }
+                                        for(std::size_t i = 0; i < shard_count && shard == shard_count; i++)
+                                        {
+                                                const std::size_t          candidate = probe_order(0, i, group);
+                                                const bag_thread_record_t* expected  = nullptr;
+                                                if(slots[candidate].owner.compare_exchange_strong(expected, &record)) shard = candidate;
+                                        }
+
+                                        cached = {id, 0, 0, shard};
+                                        return shard;
+                                }
+                                else
+                                {
+                                        const std::uint64_t current_layout = layout.load(std::memory_order_acquire);
+                                        if(cached.bag_id == id && cached.layout == current_layout) [[likely]]
+                                                return cached.shard;
+
+                                        group_t&          group  = local_group();
+                                        const std::size_t size   = group.last - group.first;
+                                        const std::size_t homes  = std::max<std::size_t>(size * active.load(std::memory_order_relaxed) / shard_count, 1);
+                                        const std::size_t ticket = cached.bag_id == id ? cached.ticket : group.tickets.fetch_add(1);
+                                        cached                   = {id, current_layout, ticket, group.first + (ticket % homes)};
+                                        return cached.shard;
+                                }
+                        }
+
+                        // Called after every operation, only every adapt_interval-th operation of a thread does any work
+                        void adapt()
+                        {
+                                if(!adaptive) return;
+                                if(++thread_registry_t::local().operations % adapt_interval != 0) [[likely]]
+                                        return;
+                                if(adapting.test_and_set(std::memory_order_acquire)) return;
+
+                                std::size_t operations = 0;
+                                std::size_t failures   = 0;
+                                for(std::size_t i = 0; i < shard_count; i++)
+                                {
+                                        operations += static_cast<std::size_t>(slots[i].counter.inserted.load(std::memory_order_relaxed));
+                                        operations += static_cast<std::size_t>(slots[i].counter.extracted.load(std::memory_order_relaxed));
+                                        if constexpr(contention_reporting_shard<Shard>) failures += slots[i].shard.contention();
+                                }
+                                const std::size_t new_operations = operations - last_operations;
+                                const std::size_t new_failures   = failures - last_failures;
+                                last_operations                  = operations;
+                                last_failures                    = failures;
+
+                                // Shrinking needs a long streak of calm windows so that the count does not flap around a contended size
+                                const std::size_t current = active.load(std::memory_order_relaxed);
+                                std::size_t       next    = current;
+                                if(new_failures * grow_ratio > new_operations)
+                                {
+                                        calm_windows = 0;
+                                        next         = std::min(current * 2, shard_count);
+                                }
+                                else if(new_failures * shrink_ratio < new_operations && ++calm_windows >= calm_to_shrink)
+                                {
+                                        calm_windows = 0;
+                                        next         = std::max<std::size_t>(current / 2, 1);
+                                }
+                                if(next != current)
+                                {
+                                        active.store(next, std::memory_order_relaxed);
+                                        layout.fetch_add(1, std::memory_order_release);
+                                }
+
+                                adapting.clear(std::memory_order_release);
+                        }
+
+                        std::optional<DataType> take(const std::size_t shard, const bool home)
+                        {
+                                if constexpr(owned_shard<Shard>)
+                                {
+                                        if(shard == shard_count) return overflow->queue.dequeue();
+                                        if(!home) return slots[shard].shard.steal();
+                                }
+                                return slots[shard].shard.dequeue();
+                        }
+
+                        template<typename OutputIterator>
+                        std::size_t take_n(const std::size_t shard, const bool home, OutputIterator& out, const std::size_t count)
+                        {
+                                if constexpr(!owned_shard<Shard> && requires(Shard& shard) { shard.dequeue_n(out, count); })
+                                        return slots[shard].shard.dequeue_n(out, count);
+
+                                std::size_t taken = 0;
+                                while(taken < count)
+                                {
+                                        std::optional<DataType> element = take(shard, home);
+                                        if(!element) break;
+                                        *out++ = std::move(*element);
+                                        taken++;
+                                }
+                                return taken;
+                        }
+
+                        // Cheap hint read from the shard's own counters, may be stale in either direction
+                        bool looks_empty(const std::size_t shard) const
                         {
-                                thread_local int idx = omp_get_thread_num() % Spread;
+                                const std::int_least64_t extracted = counter(shard).extracted.load(std::memory_order_relaxed);
+                                return counter(shard).inserted.load(std::memory_order_relaxed) <= extracted;
+                        }
 
-                                std::optional<DataType> element;
-                                for(int i = 0; static_cast<std::size_t>(i) < Spread; i++)
+                        // Only used once the home shard ran dry: probes every other shard that does not look empty, starting at a random victim, and
+                        // backs off between rounds. Shards on the same NUMA node are probed before any other. Inactive shards are probed as well,
+                        // they may still hold elements, and so is the overflow queue of owned bags after all shards. The shard the element came
+                        // from is stored in from.
+                        std::optional<DataType> steal(const std::size_t home, std::size_t& from)
+                        {
+                                bag_thread_record_t& record = thread_registry_t::local();
+                                const group_t&       group  = local_group();
+                                for(std::size_t round = 0; round < steal_rounds; round++)
                                 {
-                                        element = data[idx].dequeue();
-                                        idx     = (idx + 1) % Spread;
+                                        bool              all_empty = true;
+                                        const std::size_t victim    = static_cast<std::size_t>(record.next_random() % shard_count);
+                                        for(std::size_t i = 0; i < shard_count; i++)
+                                        {
+                                                const std::size_t shard = probe_order(victim, i, group);
+                                                if(shard == home) continue;
+                                                if(looks_empty(shard))
+                                                {
+                                                        slots[shard].events.add(event_t::empty_probes);
+                                                        continue;
+                                                }
+
+                                                all_empty                       = false;
+                                                std::optional<DataType> element = take(shard, false);
+                                                if(element)
+                                                {
+                                                        from = shard;
+                                                        return element;
+                                                }
+                                                slots[shard].events.add(event_t::empty_probes);
+                                        }
+                                        if(home != shard_count && overflow && !looks_empty(shard_count))
+                                        {
+                                                all_empty                       = false;
+                                                std::optional<DataType> element = take(shard_count, false);
+                                                if(element)
+                                                {
+                                                        from = shard_count;
+                                                        return element;
+                                                }
+                                        }
+                                        if(all_empty) break;
+
+                                        for(std::size_t i = 0; i < (1UZ << round); i++) std::this_thread::yield();
+                                }
+                                return {};
+                        }
+
+                        // Takes an element from any shard. The hints are read with seq_cst and the inserted counters are bumped with seq_cst
+                        // before producers look for parked consumers: a shard whose counters balance is either empty or its producer has yet to
+                        // see the consumer that is about to park.
+                        std::optional<DataType> take_any()
+                        {
+                                const std::size_t home   = home_shard();
+                                const std::size_t queues = queue_count();
+                                for(std::size_t i = 0; i < queues; i++)
+                                {
+                                        const std::size_t        shard     = (home + i) % queues;
+                                        const std::int_least64_t extracted = counter(shard).extracted.load();
+                                        if(counter(shard).inserted.load() <= extracted) continue;
+
+                                        std::optional<DataType> element = take(shard, shard == home);
                                         if(element)
                                         {
-                                                std::atomic_fetch_sub(&num_elements, 1);
-                                                break;
+                                                counter(shard).extracted.fetch_add(1, std::memory_order_relaxed);
+                                                return element;
                                         }
-                                        if(this->size() == 0) break;
                                 }
+                                return {};
+                        }
+
+                        void append_waiter(waiter_t& waiter)
+                        {
+                                waiter.previous = parked_tail;
+                                waiter.next     = nullptr;
+                                waiter.queued   = true;
+                                (parked_tail ? parked_tail->next : parked_head) = &waiter;
+                                parked_tail                                      = &waiter;
+                        }
+
+                        void remove_waiter(waiter_t& waiter)
+                        {
+                                (waiter.previous ? waiter.previous->next : parked_head) = waiter.next;
+                                (waiter.next ? waiter.next->previous : parked_tail)     = waiter.previous;
+                                waiter.queued                                            = false;
+                                parked.fetch_sub(1);
+                        }
+
+                        // Registers the waiter unless an element turns up in the meantime, in which case it is stored in the waiter and false is returned
+                        bool park(waiter_t& waiter)
+                        {
+                                const std::lock_guard lock(parking_lock);
+                                parked.fetch_add(1);
+                                waiter.value = take_any();
+                                if(waiter.value)
+                                {
+                                        parked.fetch_sub(1);
+                                        return false;
+                                }
+
+                                append_waiter(waiter);
+                                return true;
+                        }
+
+                        // Withdraws a waiter that gave up, returns false if a producer has already picked it
+                        bool unpark(waiter_t& waiter)
+                        {
+                                const std::lock_guard lock(parking_lock);
+                                if(!waiter.queued) return false;
+                                remove_waiter(waiter);
+                                return true;
+                        }
+
+                        // Called by producers after publishing elements, costs a single load as long as nobody is parked. Waiters are woken
+                        // outside of the lock since resumed coroutines may call back into the bag.
+                        void wake_parked()
+                        {
+                                if(parked.load() == 0) [[likely]]
+                                        return;
+
+                                waiter_t* woken = nullptr;
+                                {
+                                        const std::lock_guard lock(parking_lock);
+                                        while(parked_head)
+                                        {
+                                                std::optional<DataType> element = take_any();
+                                                if(!element) break;
+
+                                                waiter_t* const waiter = parked_head;
+                                                remove_waiter(*waiter);
+                                                waiter->value = std::move(element);
+                                                waiter->next  = woken;
+                                                woken         = waiter;
+                                        }
+                                }
+                                while(woken)
+                                {
+                                        waiter_t* const next = woken->next;
+                                        if(woken->handle)
+                                                woken->handle.resume();
+                                        else
+                                                woken->ready.release();
+                                        woken = next;
+                                }
+                        }
+
+                        // Bookkeeping after count elements were published to shard
+                        void inserted(const std::size_t shard, const std::size_t count)
+                        {
+                                counter(shard).inserted.fetch_add(static_cast<std::int_least64_t>(count));
+                                wake_parked();
+                                adapt();
+                        }
+
+                        // Threads without a shard of their own emplace into the overflow queue
+                        template<typename... Args>
+                        bool emplace_into(const std::size_t shard, Args&&... args)
+                        {
+                                if constexpr(owned_shard<Shard>)
+                                {
+                                        if(shard == shard_count) return overflow->queue.emplace(std::forward<Args>(args)...);
+                                }
+                                return slots[shard].shard.emplace(std::forward<Args>(args)...);
+                        }
+
+                        // Uses the batch insert of the queue if it has one, returns how many elements were added and moves first past them
+                        template<typename Queue, typename Iterator>
+                        static std::size_t append(Queue& queue, Iterator& first, Iterator last)
+                        {
+                                if constexpr(requires { queue.enqueue_range(first, last); })
+                                {
+                                        const std::size_t added = queue.enqueue_range(first, last);
+                                        std::ranges::advance(first, static_cast<std::iter_difference_t<Iterator>>(added));
+                                        return added;
+                                }
+                                else
+                                {
+                                        std::size_t added = 0;
+                                        for(; first != last && queue.enqueue(*first); ++first) added++;
+                                        return added;
+                                }
+                        }
+
+                        template<bool Const>
+                        shard_iterator_t<Const> shard_begin(const std::size_t shard) const
+                        {
+                                if constexpr(Const)
+                                        return std::as_const(slots[shard].shard).begin();
+                                else
+                                        return slots[shard].shard.begin();
+                        }
+
+                        template<bool Const>
+                        shard_iterator_t<Const> shard_end(const std::size_t shard) const
+                        {
+                                if constexpr(Const)
+                                        return std::as_const(slots[shard].shard).end();
+                                else
+                                        return slots[shard].shard.end();
+                        }
+
+                        template<bool Const>
+                        overflow_iterator_t<Const> overflow_begin() const
+                        {
+                                if constexpr(Const)
+                                        return std::as_const(overflow->queue).begin();
+                                else
+                                        return overflow->queue.begin();
+                        }
+
+                        template<bool Const>
+                        overflow_iterator_t<Const> overflow_end() const
+                        {
+                                if constexpr(Const)
+                                        return std::as_const(overflow->queue).end();
+                                else
+                                        return overflow->queue.end();
+                        }
+
+                        // Moves up to chunk_size elements out of the cursor into [first, last), false once the shard is exhausted
+                        template<bool Const>
+                        static bool claim_chunk(cursor_t<Const>& cursor, shard_iterator_t<Const>& first, shard_iterator_t<Const>& last)
+                        {
+                                while(cursor.busy.test_and_set(std::memory_order_acquire)) std::this_thread::yield();
+                                first = cursor.position;
+                                last  = first;
+                                for(std::size_t i = 0; i < chunk_size && last != cursor.stop; i++) ++last;
+                                cursor.position = last;
+                                cursor.busy.clear(std::memory_order_release);
+                                return first != last;
+                        }
+
+                        // Shards whose iterators yield copies get the modified copy written back
+                        template<bool Const, typename Func>
+                        static void visit(const shard_iterator_t<Const>& it, Func& f)
+                        {
+                                if constexpr(Const || std::is_lvalue_reference_v<std::iter_reference_t<shard_iterator_t<Const>>>)
+                                        f(*it);
+                                else
+                                {
+                                        DataType value = *it;
+                                        f(value);
+                                        it.store(value);
+                                }
+                        }
+
+                        // Every worker starts on its own shard and drains it chunk by chunk before moving on to the next one, so workers that
+                        // run out of work join the others on the large shards
+                        template<bool Const, typename Func>
+                        void traverse(cursor_t<Const>* const cursors, const std::size_t worker, Func& f) const
+                        {
+                                shard_iterator_t<Const> first;
+                                shard_iterator_t<Const> last;
+                                for(std::size_t i = 0; i < shard_count; i++)
+                                {
+                                        cursor_t<Const>& cursor = cursors[(worker + i) % shard_count];
+                                        while(claim_chunk<Const>(cursor, first, last))
+                                        {
+                                                for(; first != last; ++first) visit<Const>(first, f);
+                                        }
+                                }
+                        }
+
+                        template<bool Const, typename Executor, typename Func>
+                        void traverse_parallel(Executor& executor, Func& f, const std::size_t workers) const
+                        {
+                                if(workers == 0) throw std::logic_error("A traversal needs at least one worker\n");
+
+                                const std::unique_ptr<cursor_t<Const>[]> cursors(new cursor_t<Const>[shard_count]);
+                                for(std::size_t i = 0; i < shard_count; i++)
+                                {
+                                        cursors[i].position = shard_begin<Const>(i);
+                                        cursors[i].stop     = shard_end<Const>(i);
+                                }
+
+                                // Every task works on its own copy of f, the calling thread takes part as worker 0
+                                std::latch  done(static_cast<std::ptrdiff_t>(workers - 1));
+                                std::size_t launched = 1;
+                                try
+                                {
+                                        for(; launched < workers; launched++)
+                                        {
+                                                executor(
+                                                        [this, &cursors, &done, worker = launched, f]() mutable
+                                                        {
+                                                                traverse<Const>(cursors.get(), worker, f);
+                                                                done.count_down();
+                                                        });
+                                        }
+                                        // The overflow queue only holds the elements of threads that found no free shard, the calling thread walks it alone
+                                        if constexpr(owned_shard<Shard>)
+                                        {
+                                                for(overflow_iterator_t<Const> it = overflow_begin<Const>(); it != overflow_end<Const>(); ++it) f(*it);
+                                        }
+                                        traverse<Const>(cursors.get(), 0, f);
+                                }
+                                catch(...)
+                                {
+                                        // Tasks that already run still use cursors and their copy of f, so wait for them and count down the ones that were
+                                        // never handed out before the exception leaves
+                                        done.count_down(static_cast<std::ptrdiff_t>(workers - launched));
+                                        done.wait();
+                                        throw;
+                                }
+                                done.wait();
+                        }
+
+                        static std::size_t default_workers()
+                        {
+                                return std::max<std::size_t>(1, std::thread::hardware_concurrency());
+                        }
+
+                public:
+                        // Forward iterator over all elements, shard by shard and the overflow queue of owned bags last. Like for_all it must not
+                        // run concurrently with extractions.
+                        template<bool Const>
+                        class basic_iterator_t
+                        {
+                                private:
+                                        using bag_t = std::conditional_t<Const, const WaitFreeBag, WaitFreeBag>;
+
+                                        bag_t*                     bag   = nullptr;
+                                        std::size_t                shard = 0;
+                                        shard_iterator_t<Const>    position {};
+                                        shard_iterator_t<Const>    stop {};
+                                        overflow_iterator_t<Const> overflow_position {};
+                                        overflow_iterator_t<Const> overflow_stop {};
+
+                                        bool in_overflow() const
+                                        {
+                                                return owned_shard<Shard> && shard == bag->shard_count;
+                                        }
+
+                                        void open()
+                                        {
+                                                if(in_overflow())
+                                                {
+                                                        overflow_position = bag->template overflow_begin<Const>();
+                                                        overflow_stop     = bag->template overflow_end<Const>();
+                                                        position          = stop = {};
+                                                }
+                                                else
+                                                {
+                                                        position = bag->template shard_begin<Const>(shard);
+                                                        stop     = bag->template shard_end<Const>(shard);
+                                                }
+                                        }
+
+                                        bool exhausted() const
+                                        {
+                                                return in_overflow() ? overflow_position == overflow_stop : position == stop;
+                                        }
+
+                                        void settle()
+                                        {
+                                                const std::size_t queues = bag->queue_count();
+                                                while(shard < queues && exhausted())
+                                                {
+                                                        if(++shard == queues) break;
+                                                        open();
+                                                }
+                                                if(shard == queues)
+                                                {
+                                                        position          = stop = {};
+                                                        overflow_position = overflow_stop = {};
+                                                }
+                                        }
+
+                                public:
+                                        using iterator_concept  = std::forward_iterator_tag;
+                                        using iterator_category = std::conditional_t<std::is_lvalue_reference_v<std::iter_reference_t<shard_iterator_t<Const>>>,
+                                                                                     std::forward_iterator_tag,
+                                                                                     std::input_iterator_tag>;
+                                        using value_type        = DataType;
+                                        using difference_type   = std::ptrdiff_t;
+                                        using reference         = std::iter_reference_t<shard_iterator_t<Const>>;
+
+                                        basic_iterator_t() = default;
+
+                                        basic_iterator_t(bag_t* const bag, const std::size_t shard): bag(bag), shard(shard)
+                                        {
+                                                if(shard < bag->queue_count()) open();
+                                                settle();
+                                        }
+
+                                        reference operator*() const
+                                        {
+                                                if constexpr(owned_shard<Shard>)
+                                                {
+                                                        if(in_overflow()) return *overflow_position;
+                                                }
+                                                return *position;
+                                        }
+
+                                        basic_iterator_t& operator++()
+                                        {
+                                                if(in_overflow())
+                                                        ++overflow_position;
+                                                else
+                                                        ++position;
+                                                settle();
+                                                return *this;
+                                        }
+
+                                        basic_iterator_t operator++(int)
+                                        {
+                                                const basic_iterator_t previous = *this;
+                                                ++*this;
+                                                return previous;
+                                        }
+
+                                        bool operator==(const basic_iterator_t& other) const
+                                        {
+                                                return shard == other.shard && position == other.position && overflow_position == other.overflow_position;
+                                        }
+                        };
+
+                        using value_type     = DataType;
+                        using iterator       = basic_iterator_t<false>;
+                        using const_iterator = basic_iterator_t<true>;
+
+                        // Suspends the awaiting coroutine until an element is available. The coroutine is resumed on the producer thread that
+                        // hands over the element.
+                        class extract_awaiter_t
+                        {
+                                private:
+                                        WaitFreeBag& bag;
+                                        waiter_t     waiter;
+
+                                public:
+                                        explicit extract_awaiter_t(WaitFreeBag& bag): bag(bag) {}
+
+                                        bool await_ready()
+                                        {
+                                                waiter.value = bag.extract();
+                                                return waiter.value.has_value();
+                                        }
+
+                                        bool await_suspend(std::coroutine_handle<> handle)
+                                        {
+                                                waiter.handle = handle;
+                                                return bag.park(waiter);
+                                        }
+
+                                        DataType await_resume()
+                                        {
+                                                return std::move(*waiter.value);
+                                        }
+                        };
+
+                        // Shards are split into one group per NUMA node, unless there are fewer shards than nodes
+                        explicit WaitFreeBag(const std::size_t shards = Spread, const bool adaptive = false):
+                                shard_count(shards),
+                                slots(new slot_t[shards]),
+                                adaptive(adaptive),
+                                group_count(shards >= topology.nodes() ? topology.nodes() : 1),
+                                groups(new group_t[group_count]),
+                                overflow(owned_shard<Shard> ? new overflow_slot_t() : nullptr),
+                                active(shards)
+                        {
+                                if(shards == 0) throw std::logic_error("A bag needs at least one shard\n");
+                                if(adaptive && !contention_reporting_shard<Shard>) throw std::logic_error("Shard does not report contention\n");
+                                for(std::size_t i = 0; i < group_count; i++)
+                                {
+                                        groups[i].first = i * shards / group_count;
+                                        groups[i].last  = (i + 1) * shards / group_count;
+                                }
+                        }
+
+                        WaitFreeBag(const WaitFreeBag&)            = delete;
+                        WaitFreeBag& operator=(const WaitFreeBag&) = delete;
+
+                        // Number of shards currently handed out as homes
+                        std::size_t active_shards() const
+                        {
+                                return active.load(std::memory_order_relaxed);
+                        }
+
+                        // Number of NUMA nodes the shards are grouped by, 1 on single node machines
+                        std::size_t numa_nodes() const
+                        {
+                                return group_count;
+                        }
+
+                        void reserve(std::size_t count)
+                        {
+                                Shard::reserve(count);
+                        }
+
+                        void insert(const DataType& element)
+                        {
+                                emplace(element);
+                        }
+
+                        void insert(DataType&& element)
+                        {
+                                emplace(std::move(element));
+                        }
+
+                        // Constructs the element in place inside the home shard, or inside the overflow queue for threads of owned bags that
+                        // found no free shard. Bounded shards that are full pass the element on to the next shard, it only throws once every
+                        // shard refused it.
+                        template<typename... Args>
+                        void emplace(Args&&... args)
+                        {
+                                if(!try_emplace(std::forward<Args>(args)...)) throw std::logic_error("Could not insert object\n");
+                        }
+
+                        bool try_insert(const DataType& element)
+                        {
+                                return try_emplace(element);
+                        }
+
+                        bool try_insert(DataType&& element)
+                        {
+                                return try_emplace(std::move(element));
+                        }
+
+                        // Tries the home shard first and falls back to the other shards when it is full, returns false once every shard refused
+                        // the element. Owned shards only accept elements from their owner, so only the home shard or the overflow queue is tried.
+                        template<typename... Args>
+                        bool try_emplace(Args&&... args)
+                        {
+                                const std::size_t home     = home_shard();
+                                const std::size_t attempts = owned_shard<Shard> ? 1 : shard_count;
+                                for(std::size_t i = 0; i < attempts; i++)
+                                {
+                                        const std::size_t shard = owned_shard<Shard> ? home : (home + i) % shard_count;
+                                        if(emplace_into(shard, std::forward<Args>(args)...))
+                                        {
+                                                inserted(shard, 1);
+                                                return true;
+                                        }
+                                }
+                                return false;
+                        }
+
+                        std::optional<DataType> extract()
+                        {
+                                const std::size_t       home    = home_shard();
+                                std::size_t             from    = home;
+                                std::optional<DataType> element = take(home, true);
+                                events.add(event_t::extracts);
+                                if(!element)
+                                {
+                                        if(home < shard_count) slots[home].events.add(event_t::empty_probes);
+                                        element = steal(home, from);
+                                }
+                                if(element) counter(from).extracted.fetch_add(1, std::memory_order_relaxed);
+                                adapt();
 
                                 return element;
                         }
 
+                        // Spins for a few attempts and then parks until a producer hands over an element
+                        DataType extract_wait()
+                        {
+                                for(std::size_t attempt = 0; attempt < spin_attempts; attempt++)
+                                {
+                                        std::optional<DataType> element = extract();
+                                        if(element) return std::move(*element);
+                                        std::this_thread::yield();
+                                }
+
+                                waiter_t waiter;
+                                if(park(waiter)) waiter.ready.acquire();
+                                return std::move(*waiter.value);
+                        }
+
+                        // Like extract_wait but gives up once timeout has passed
+                        template<typename Rep, typename Period>
+                        std::optional<DataType> extract_for(const std::chrono::duration<Rep, Period>& timeout)
+                        {
+                                const auto deadline = std::chrono::steady_clock::now() + timeout;
+                                for(std::size_t attempt = 0; attempt < spin_attempts && std::chrono::steady_clock::now() < deadline; attempt++)
+                                {
+                                        std::optional<DataType> element = extract();
+                                        if(element) return element;
+                                        std::this_thread::yield();
+                                }
+
+                                waiter_t waiter;
+                                if(!park(waiter) || waiter.ready.try_acquire_until(deadline)) return std::move(waiter.value);
+                                if(unpark(waiter)) return {};
+
+                                // A producer picked the waiter right before it gave up, the element is on its way
+                                waiter.ready.acquire();
+                                return std::move(waiter.value);
+                        }
+
+                        extract_awaiter_t extract_async()
+                        {
+                                return extract_awaiter_t(*this);
+                        }
+
+                        // Publishes the whole range to the home shard, or to the overflow queue like emplace, paying for one tail CAS and one
+                        // counter update. Whatever a full bounded shard refuses goes to the next shards like in emplace.
+                        template<std::input_iterator Iterator>
+                                requires std::forward_iterator<Iterator> || std::sized_sentinel_for<Iterator, Iterator>
+                        void insert_range(Iterator first, Iterator last)
+                        {
+                                const std::size_t home  = home_shard();
+                                const std::size_t count = static_cast<std::size_t>(std::ranges::distance(first, last));
+                                std::size_t       added = 0;
+                                if constexpr(owned_shard<Shard>)
+                                {
+                                        added = home == shard_count ? append(overflow->queue, first, last) : append(slots[home].shard, first, last);
+                                        inserted(home, added);
+                                }
+                                else
+                                {
+                                        for(std::size_t i = 0; i < shard_count && added != count; i++)
+                                        {
+                                                const std::size_t shard = (home + i) % shard_count;
+                                                const std::size_t part  = append(slots[shard].shard, first, last);
+                                                if(part > 0) inserted(shard, part);
+                                                added += part;
+                                        }
+                                }
+
+                                if(added != count) throw std::logic_error("Could not insert object\n");
+                        }
+
+                        // Takes up to count elements out of a single shard, the home shard if it is not empty, and returns how many were written to out
+                        template<typename OutputIterator>
+                        std::size_t extract_n(OutputIterator out, std::size_t count)
+                        {
+                                if(count == 0) return 0;
+
+                                const std::size_t home      = home_shard();
+                                std::size_t       from      = home;
+                                std::size_t       extracted = take_n(home, true, out, count);
+                                events.add(event_t::extracts);
+                                if(extracted == 0)
+                                {
+                                        if(home < shard_count) slots[home].events.add(event_t::empty_probes);
+                                        const group_t&    group  = local_group();
+                                        const std::size_t victim = static_cast<std::size_t>(thread_registry_t::local().next_random() % shard_count);
+                                        for(std::size_t i = 0; i < shard_count && extracted == 0; i++)
+                                        {
+                                                from = probe_order(victim, i, group);
+                                                if(from == home) continue;
+                                                if(!looks_empty(from)) extracted = take_n(from, false, out, count);
+                                                if(extracted == 0) slots[from].events.add(event_t::empty_probes);
+                                        }
+                                        if(extracted == 0 && home != shard_count && overflow && !looks_empty(shard_count))
+                                        {
+                                                from      = shard_count;
+                                                extracted = take_n(from, false, out, count);
+                                        }
+                                }
+                                if(extracted > 0) counter(from).extracted.fetch_add(static_cast<std::int_least64_t>(extracted), std::memory_order_relaxed);
+                                adapt();
+
+                                return extracted;
+                        }
+
+                        // Relaxed sum over the shard counters, cheap but only exact when no other thread modifies the bag
+                        std::size_t size_approx() const
+                        {
+                                std::int_least64_t total  = 0;
+                                const std::size_t  queues = queue_count();
+                                for(std::size_t i = 0; i < queues; i++)
+                                {
+                                        total += counter(i).inserted.load(std::memory_order_relaxed);
+                                        total -= counter(i).extracted.load(std::memory_order_relaxed);
+                                }
+                                return total > 0 ? static_cast<std::size_t>(total) : 0;
+                        }
+
+                        // Exact snapshot: rescans the shard counters until two consecutive scans agree. The counters never decrease, so equal sums
+                        // imply that every single counter is unchanged. A bag that keeps changing for size_scans scans gets size_approx instead.
                         std::size_t size() const
                         {
-                                return static_cast<std::size_t>(num_elements);
+                                const std::size_t  queues    = queue_count();
+                                std::int_least64_t inserted  = -1;
+                                std::int_least64_t extracted = -1;
+                                for(std::size_t scan = 0; scan < size_scans; scan++)
+                                {
+                                        std::int_least64_t current_inserted  = 0;
+                                        std::int_least64_t current_extracted = 0;
+                                        for(std::size_t i = 0; i < queues; i++)
+                                        {
+                                                current_inserted += counter(i).inserted.load(std::memory_order_acquire);
+                                                current_extracted += counter(i).extracted.load(std::memory_order_acquire);
+                                        }
+                                        if(current_inserted == inserted && current_extracted == extracted)
+                                        {
+                                                const std::int_least64_t total = inserted - extracted;
+                                                return total > 0 ? static_cast<std::size_t>(total) : 0;
+                                        }
+                                        inserted  = current_inserted;
+                                        extracted = current_extracted;
+                                }
+                                return size_approx();
+                        }
+
+                        iterator begin()
+                        {
+                                return iterator(this, 0);
+                        }
+
+                        iterator end()
+                        {
+                                return iterator(this, queue_count());
+                        }
+
+                        const_iterator begin() const
+                        {
+                                return const_iterator(this, 0);
+                        }
+
+                        const_iterator end() const
+                        {
+                                return const_iterator(this, queue_count());
+                        }
+
+                        // Splits the shards into chunks of chunk_size elements that workers claim dynamically, so a single large shard is still
+                        // shared by all workers. workers - 1 tasks are handed to executor, the calling thread joins in and returns once all are
+                        // done. Must not run concurrently with extractions.
+                        template<executor Executor, typename Func>
+                                requires invokable<Func, DataType>
+                        void for_all(Executor&& executor, Func f, const std::size_t workers = default_workers())
+                        {
+                                traverse_parallel<false>(executor, f, workers);
+                        }
+
+                        // Read-only traversal, may run concurrently with other read-only traversals
+                        template<executor Executor, typename Func>
+                                requires const_invokable<Func, DataType>
+                        void for_all(Executor&& executor, Func f, const std::size_t workers = default_workers()) const
+                        {
+                                traverse_parallel<true>(executor, f, workers);
+                        }
+
+                        // Parallel for_all on freshly started threads, independent of OpenMP
+                        template<typename Func>
+                                requires invokable<Func, DataType>
+                        void for_all_par(Func f, const std::size_t workers = default_workers())
+                        {
+                                std::vector<std::jthread> threads;
+                                threads.reserve(workers);
+                                for_all(
+                                        [&threads](std::function<void()> task)
+                                        {
+                                                threads.emplace_back(std::move(task));
+                                        },
+                                        f,
+                                        workers);
+                        }
+
+                        template<typename Func>
+                                requires const_invokable<Func, DataType>
+                        void for_all_par(Func f, const std::size_t workers = default_workers()) const
+                        {
+                                std::vector<std::jthread> threads;
+                                threads.reserve(workers);
+                                for_all(
+                                        [&threads](std::function<void()> task)
+                                        {
+                                                threads.emplace_back(std::move(task));
+                                        },
+                                        f,
+                                        workers);
+                        }
+
+                        // Snapshot of the instrumentation counters, summed over all threads at the time of the call. Without WAIT_FREE_BAG_STATS only
+                        // the occupancy, the number of active shards and the NUMA layout are filled in. extracts counts calls of extract and extract_n.
+                        bag_stats_t stats() const
+                        {
+                                bag_stats_t snapshot;
+                                snapshot.active_shards = active_shards();
+                                snapshot.numa_nodes    = numa_nodes();
+                                snapshot.extracts      = events.load(event_t::extracts);
+                                snapshot.shards.resize(shard_count);
+                                for(std::size_t i = 0; i < shard_count; i++)
+                                {
+                                        shard_stats_t& shard = snapshot.shards[i];
+                                        if constexpr(stats_reporting_shard<Shard>) shard = slots[i].shard.stats();
+                                        shard.empty_probes = slots[i].events.load(event_t::empty_probes);
+                                        shard.occupancy    = slots[i].counter.inserted.load(std::memory_order_relaxed) - slots[i].counter.extracted.load(std::memory_order_relaxed);
+                                        snapshot.total += shard;
+                                }
+                                if(overflow) snapshot.total.occupancy += overflow->counter.inserted.load(std::memory_order_relaxed) - overflow->counter.extracted.load(std::memory_order_relaxed);
+                                return snapshot;
                         }
 
                         template<typename Func>
@@ -216,9 +1459,13 @@ namespace wait_free_bag
                                 #pragma omp barrier
                                 int idx = omp_get_thread_num();
 
-                                while(static_cast<std::size_t>(idx) < Spread)
+                                while(static_cast<std::size_t>(idx) < queue_count())
                                 {
-                                        data[idx].for_all(f);
+                                        if constexpr(owned_shard<Shard>)
+                                        {
+                                                if(static_cast<std::size_t>(idx) == shard_count) overflow->queue.for_all(f);
+                                        }
+                                        if(static_cast<std::size_t>(idx) < shard_count) slots[idx].shard.for_all(f);
                                         idx = (idx + omp_get_num_threads());
                                 }
                                 #pragma omp barrier
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <atomic>
+#include <concepts.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <stats.hpp>
+#include <type_traits>
+#include <utility>
+
+namespace wait_free_bag
+{
+        // Ref: https://www.di.ens.fr/~zappa/readings/ppopp13.pdf
+        // Chase-Lev work stealing deque. Only the owning thread may call enqueue and dequeue, which work on the bottom end and only need a CAS
+        // when they race with a thief for the very last element. Any other thread takes elements from the top end with steal. The circular
+        // buffer doubles when full; old buffers may still be read by thieves and are kept until the deque is destroyed.
+        // Elements are read speculatively by thieves, so they are stored in lock-free atomics; store pointers for larger items.
+        template<typename DataType, std::size_t InitialCapacity = 256>
+        class WorkStealingDeque
+        {
+                private:
+                        static_assert(std::is_trivially_copyable_v<DataType> && std::atomic<DataType>::is_always_lock_free, "DataType must fit in a lock-free atomic");
+                        static_assert(InitialCapacity > 0 && (InitialCapacity & (InitialCapacity - 1)) == 0, "InitialCapacity must be a power of two");
+
+                        struct buffer_t
+                        {
+                                public:
+                                        const std::int64_t     capacity;
+                                        buffer_t* const        previous;
+                                        std::atomic<DataType>* slots;
+
+                                        buffer_t(std::int64_t capacity, buffer_t* previous): capacity(capacity), previous(previous), slots(new std::atomic<DataType>[static_cast<std::size_t>(capacity)]) {}
+
+                                        std::atomic<DataType>& at(std::int64_t idx)
+                                        {
+                                                return slots[idx & (capacity - 1)];
+                                        }
+
+                                        ~buffer_t()
+                                        {
+                                                delete[] slots;
+                                        }
+                        };
+
+                        alignas(64) std::atomic<std::int64_t> top    = 0;
+                        alignas(64) std::atomic<std::int64_t> bottom = 0;
+                        std::atomic<buffer_t*> buffer;
+                        [[no_unique_address]] EventCounters<> events;
+
+                        buffer_t* grow(buffer_t* const old, const std::int64_t top_copy, const std::int64_t bottom_copy)
+                        {
+                                buffer_t* const bigger = new buffer_t(old->capacity * 2, old);
+                                for(std::int64_t i = top_copy; i < bottom_copy; i++) bigger->at(i).store(old->at(i).load(std::memory_order_relaxed), std::memory_order_relaxed);
+                                buffer.store(bigger, std::memory_order_release);
+                                return bigger;
+                        }
+
+                        // Elements live in atomics, so dereferencing yields a copy and store writes a modified copy back
+                        class basic_iterator_t
+                        {
+                                private:
+                                        buffer_t*    current = nullptr;
+                                        std::int64_t index   = 0;
+
+                                public:
+                                        using iterator_concept  = std::forward_iterator_tag;
+                                        using iterator_category = std::input_iterator_tag;
+                                        using value_type        = DataType;
+                                        using difference_type   = std::ptrdiff_t;
+                                        using reference         = DataType;
+
+                                        basic_iterator_t() = default;
+
+                                        basic_iterator_t(buffer_t* const current, const std::int64_t index): current(current), index(index) {}
+
+                                        reference operator*() const
+                                        {
+                                                return current->at(index).load(std::memory_order_relaxed);
+                                        }
+
+                                        void store(const DataType& value) const
+                                        {
+                                                current->at(index).store(value, std::memory_order_relaxed);
+                                        }
+
+                                        basic_iterator_t& operator++()
+                                        {
+                                                index++;
+                                                return *this;
+                                        }
+
+                                        basic_iterator_t operator++(int)
+                                        {
+                                                const basic_iterator_t previous = *this;
+                                                ++*this;
+                                                return previous;
+                                        }
+
+                                        bool operator==(const basic_iterator_t&) const = default;
+                        };
+
+                public:
+                        using value_type     = DataType;
+                        using iterator       = basic_iterator_t;
+                        using const_iterator = basic_iterator_t;
+
+                        WorkStealingDeque(): buffer(new buffer_t(static_cast<std::int64_t>(InitialCapacity), nullptr)) {}
+
+                        // Owner only
+                        bool enqueue(const DataType& data)
+                        {
+                                const std::int64_t bottom_copy = bottom.load(std::memory_order_relaxed);
+                                const std::int64_t top_copy    = top.load(std::memory_order_acquire);
+                                buffer_t*          current     = buffer.load(std::memory_order_relaxed);
+                                if(bottom_copy - top_copy > current->capacity - 1) current = grow(current, top_copy, bottom_copy);
+
+                                current->at(bottom_copy).store(data, std::memory_order_relaxed);
+                                std::atomic_thread_fence(std::memory_order_release);
+                                bottom.store(bottom_copy + 1, std::memory_order_relaxed);
+                                return true;
+                        }
+
+                        // Owner only
+                        template<typename... Args>
+                        bool emplace(Args&&... args)
+                        {
+                                return enqueue(DataType(std::forward<Args>(args)...));
+                        }
+
+                        // Owner only
+                        std::optional<DataType> dequeue()
+                        {
+                                const std::int64_t bottom_copy = bottom.load(std::memory_order_relaxed) - 1;
+                                buffer_t* const    current     = buffer.load(std::memory_order_relaxed);
+                                bottom.store(bottom_copy, std::memory_order_relaxed);
+                                std::atomic_thread_fence(std::memory_order_seq_cst);
+                                std::int64_t top_copy = top.load(std::memory_order_relaxed);
+
+                                if(top_copy > bottom_copy) // Deque is empty
+                                {
+                                        bottom.store(bottom_copy + 1, std::memory_order_relaxed);
+                                        return {};
+                                }
+
+                                std::optional<DataType> value = current->at(bottom_copy).load(std::memory_order_relaxed);
+                                if(top_copy == bottom_copy) // Last element, race against thieves
+                                {
+                                        events.add(event_t::cas_attempts);
+                                        if(!top.compare_exchange_strong(top_copy, top_copy + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                                        {
+                                                events.add(event_t::cas_failures);
+                                                value.reset();
+                                        }
+                                        bottom.store(bottom_copy + 1, std::memory_order_relaxed);
+                                }
+                                return value;
+                        }
+
+                        // Any thread, fails spuriously when another thread wins the race for the top element
+                        std::optional<DataType> steal()
+                        {
+                                std::int64_t top_copy = top.load(std::memory_order_acquire);
+                                std::atomic_thread_fence(std::memory_order_seq_cst);
+                                const std::int64_t bottom_copy = bottom.load(std::memory_order_acquire);
+                                if(top_copy >= bottom_copy) return {};
+
+                                buffer_t* const current = buffer.load(std::memory_order_acquire);
+                                const DataType  value   = current->at(top_copy).load(std::memory_order_relaxed);
+                                events.add(event_t::cas_attempts);
+                                if(!top.compare_exchange_strong(top_copy, top_copy + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                                {
+                                        events.add(event_t::cas_failures);
+                                        return {};
+                                }
+                                return value;
+                        }
+
+                        bool empty() const
+                        {
+                                return top.load(std::memory_order_acquire) >= bottom.load(std::memory_order_acquire);
+                        }
+
+                        template<typename Func>
+                                requires invokable<Func, DataType>
+                        void for_all(Func f)
+                        {
+                                buffer_t* const    current     = buffer.load();
+                                const std::int64_t bottom_copy = bottom.load();
+                                for(std::int64_t i = top.load(); i < bottom_copy; i++)
+                                {
+                                        DataType value = current->at(i).load(std::memory_order_relaxed);
+                                        f(value);
+                                        current->at(i).store(value, std::memory_order_relaxed);
+                                }
+                        }
+
+                        // The owner and thieves both move the ends of the buffer, so neither may run during a traversal
+                        iterator begin() const
+                        {
+                                return iterator(buffer.load(), top.load());
+                        }
+
+                        iterator end() const
+                        {
+                                return iterator(buffer.load(), bottom.load());
+                        }
+
+                        // CAS counts cover the races for the top element, there are no loops or tails to help
+                        shard_stats_t stats() const
+                        {
+                                return shard_events(events);
+                        }
+
+                        // The circular buffer grows on demand, there is nothing worth reserving per thread
+                        static void reserve(std::size_t) {}
+
+                        ~WorkStealingDeque()
+                        {
+                                buffer_t* current = buffer.load();
+                                while(current)
+                                {
+                                        buffer_t* const previous = current->previous;
+                                        delete current;
+                                        current = previous;
+                                }
+                        }
+        };
+} // namespace wait_free_bag
@@ -1,5 +1,8 @@
 #!/bin/bash
 
+# Number of shards of the bags under test, override with SHARDS=<count> ./collect.sh
+SHARDS=${SHARDS:-16}
+
 # Weak Scaling
 N=$((1024 * 64))
 file="weak.csv"
@@ -12,26 +15,36 @@ if [ -f ${raw_file} ]
 then
         rm ${raw_file}
 fi
-echo "P,N,Insertion Speedup, Iteration Speedup, Extraction Speedup" >> $file
+echo "P,N,Insertion Speedup, Iteration Speedup, Extraction Speedup, Adaptive Insertion Speedup, Adaptive Extraction Speedup, Active Shards" >> $file
 for i in $(seq 1 16)
 do
         P=$i
         real_N=$(($N * $P))
 
-        cmd="../../bin/evaluate ${real_N}"
+        cmd="../../bin/evaluate ${real_N} ${SHARDS}"
         backup=${OMP_NUM_THREADS}
         export OMP_NUM_THREADS=$P;
         echo -n "OMP_NUM_THREADS=${OMP_NUM_THREADS} "
         echo $cmd
         $cmd > tmp
         export OMP_NUM_THREADS=$backup;
-        cat tmp >> ${raw_file}
-        insert_speedup=$(cat tmp | cut -d, -f10)
-        iteration_speedup=$(cat tmp | cut -d, -f11)
-        extraction_speedup=$(cat tmp | cut -d, -f12)
+
+        # evaluate prints a header line followed by the results, the raw file keeps the header of the first run only
+        if [ ! -f ${raw_file} ]
+        then
+                head -n 1 tmp > ${raw_file}
+        fi
+        row=$(tail -n 1 tmp)
+        echo "${row}" >> ${raw_file}
+        insert_speedup=$(echo "${row}" | cut -d, -f10)
+        iteration_speedup=$(echo "${row}" | cut -d, -f11)
+        extraction_speedup=$(echo "${row}" | cut -d, -f12)
+        active_shards=$(echo "${row}" | cut -d, -f44)
+        adaptive_insert_speedup=$(echo "${row}" | cut -d, -f47)
+        adaptive_extraction_speedup=$(echo "${row}" | cut -d, -f48)
         rm tmp
 
-        echo "$P,${real_N},${insert_speedup},${iteration_speedup},${extraction_speedup}" >> $file
+        echo "$P,${real_N},${insert_speedup},${iteration_speedup},${extraction_speedup},${adaptive_insert_speedup},${adaptive_extraction_speedup},${active_shards}" >> $file
 done
 
 # Strong Scaling
@@ -46,23 +59,33 @@ if [ -f ${raw_file} ]
 then
         rm ${raw_file}
 fi
-echo "P,N,Insertion Speedup, Iteration Speedup, Extraction Speedup" >> $file
+echo "P,N,Insertion Speedup, Iteration Speedup, Extraction Speedup, Adaptive Insertion Speedup, Adaptive Extraction Speedup, Active Shards" >> $file
 for i in $(seq 1 16)
 do
         P=$i
 
-        cmd="../../bin/evaluate ${N}"
+        cmd="../../bin/evaluate ${N} ${SHARDS}"
         backup=${OMP_NUM_THREADS}
         export OMP_NUM_THREADS=$P;
         echo -n "OMP_NUM_THREADS=${OMP_NUM_THREADS} "
         echo $cmd
         $cmd > tmp
         export OMP_NUM_THREADS=$backup;
-        cat tmp >> ${raw_file}
-        insert_speedup=$(cat tmp | cut -d, -f10)
-        iteration_speedup=$(cat tmp | cut -d, -f11)
-        extraction_speedup=$(cat tmp | cut -d, -f12)
+
+        # evaluate prints a header line followed by the results, the raw file keeps the header of the first run only
+        if [ ! -f ${raw_file} ]
+        then
+                head -n 1 tmp > ${raw_file}
+        fi
+        row=$(tail -n 1 tmp)
+        echo "${row}" >> ${raw_file}
+        insert_speedup=$(echo "${row}" | cut -d, -f10)
+        iteration_speedup=$(echo "${row}" | cut -d, -f11)
+        extraction_speedup=$(echo "${row}" | cut -d, -f12)
+        active_shards=$(echo "${row}" | cut -d, -f44)
+        adaptive_insert_speedup=$(echo "${row}" | cut -d, -f47)
+        adaptive_extraction_speedup=$(echo "${row}" | cut -d, -f48)
         rm tmp
 
-        echo "$P,$N,${insert_speedup},${iteration_speedup},${extraction_speedup}" >> $file
+        echo "$P,$N,${insert_speedup},${iteration_speedup},${extraction_speedup},${adaptive_insert_speedup},${adaptive_extraction_speedup},${active_shards}" >> $file
 done
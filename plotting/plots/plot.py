@@ -1,4 +1,6 @@
 import csv
+import json
+import os
 from matplotlib import pyplot as plt
 import sys
 
@@ -37,12 +39,11 @@ ps = []
 blocking = []
 non_blocking = []
 with open(csv_dir + '/weak_raw.csv', newline='') as infile:
-    reader = csv.reader(infile)
-    next(reader)
+    reader = csv.DictReader(infile)
     for row in reader:
-        ps.append(float(row[0]))
-        blocking.append(float(row[6]))
-        non_blocking.append(float(row[7]))
+        ps.append(float(row['threads']))
+        blocking.append(float(row['lock_based_for_all_s']))
+        non_blocking.append(float(row['wait_free_for_all_s']))
 
 plt.figure(figsize=(9, 5))
 plt.grid()
@@ -84,12 +85,11 @@ ps = []
 blocking = []
 non_blocking = []
 with open(csv_dir + '/strong_raw.csv', newline='') as infile:
-    reader = csv.reader(infile)
-    next(reader)
+    reader = csv.DictReader(infile)
     for row in reader:
-        ps.append(float(row[0]))
-        blocking.append(float(row[6]))
-        non_blocking.append(float(row[7]))
+        ps.append(float(row['threads']))
+        blocking.append(float(row['lock_based_for_all_s']))
+        non_blocking.append(float(row['wait_free_for_all_s']))
 
 plt.figure(figsize=(9, 5))
 plt.grid()
@@ -101,3 +101,39 @@ plt.plot(ps, blocking, 'ro-', label="Blocking")
 plt.plot(ps, non_blocking, 'go-', label="Non Blocking")
 plt.legend()
 plt.savefig(out_dir + '/strong_iterate.svg', dpi=500)
+
+# Workload benchmarks written by make benchmark, one figure per element type
+if os.path.exists(csv_dir + '/benchmark.json'):
+    with open(csv_dir + '/benchmark.json') as infile:
+        results = json.load(infile)['results']
+
+    workloads = list(dict.fromkeys(r['workload'] for r in results))
+    containers = list(dict.fromkeys(r['container'] for r in results))
+    elements = list(dict.fromkeys(r['element'] for r in results))
+    width = 0.8 / len(containers)
+    # Cache misses are null where the benchmark could not open the hardware counters
+    counted = any(r.get('cache_misses_per_op') is not None for r in results)
+
+    for number, element in enumerate(elements):
+        fig, axes = plt.subplots(3 if counted else 2, 1, figsize=(12, 13 if counted else 9))
+        throughput, latency = axes[0], axes[1]
+        for i, container in enumerate(containers):
+            rows = {r['workload']: r for r in results if r['container'] == container and r['element'] == element}
+            xs = [j + i * width for j in range(len(workloads))]
+            throughput.bar(xs, [rows[w]['ops_per_second'] for w in workloads], width, label=container)
+            latency.bar(xs, [rows[w]['p99_ns'] for w in workloads], width, label=container)
+            if counted:
+                axes[2].bar(xs, [rows[w].get('cache_misses_per_op') or 0 for w in workloads], width, label=container)
+        if counted:
+            axes[2].set_ylabel("Cache misses per operation")
+        for axis in axes:
+            axis.grid(axis='y')
+            axis.set_xticks([j + 0.4 - width / 2 for j in range(len(workloads))])
+            axis.set_xticklabels(workloads)
+        throughput.set_title("Workload Benchmarks with {} Elements".format(element))
+        throughput.set_ylabel("Operations per second")
+        latency.set_ylabel("p99 latency (ns)")
+        latency.set_yscale('log')
+        throughput.legend()
+        fig.tight_layout()
+        fig.savefig(out_dir + '/benchmark_{}.svg'.format(number), dpi=500)
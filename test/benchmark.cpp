@@ -0,0 +1,379 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <linux/perf_event.h>
+#include <memory>
+#include <mutex>
+#include <omp.h>
+#include <optional>
+#include <print>
+#include <sstream>
+#include <string_view>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+#include <wait_free_bag.hpp>
+
+// Elements of a fixed size, the first bytes carry a sequence number so that copies cannot be optimised away
+template<std::size_t Size>
+struct payload_t
+{
+        public:
+                std::array<std::uint8_t, Size> bytes {};
+
+                payload_t() = default;
+
+                explicit payload_t(const std::size_t value)
+                {
+                        for(std::size_t i = 0; i < std::min(Size, sizeof(value)); i++) bytes[i] = static_cast<std::uint8_t>(value >> (8 * i));
+                }
+};
+
+// Builds the element for a sequence number, move-only elements own a heap allocated payload
+template<typename Element>
+Element make_element(const std::size_t value)
+{
+        if constexpr(requires { typename Element::element_type; })
+                return std::make_unique<typename Element::element_type>(value);
+        else
+                return Element(value);
+}
+
+// Reads and writes every byte of the payload, as a task that is taken out of the bag and put back would
+template<typename Element>
+std::size_t touch(Element& element)
+{
+        if constexpr(requires { *element; })
+                return touch(*element);
+        else
+        {
+                std::size_t sum = 0;
+                for(std::uint8_t& byte: element.bytes) sum += ++byte;
+                return sum;
+        }
+}
+
+// Hardware cache misses of the calling thread, reads -1 where perf events are not available or not permitted
+class cache_miss_counter_t
+{
+        private:
+                int descriptor = -1;
+
+        public:
+                cache_miss_counter_t()
+                {
+                        perf_event_attr attr {};
+                        attr.type           = PERF_TYPE_HARDWARE;
+                        attr.size           = sizeof(attr);
+                        attr.config         = PERF_COUNT_HW_CACHE_MISSES;
+                        attr.exclude_kernel = 1;
+                        attr.exclude_hv     = 1;
+                        descriptor          = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+                }
+
+                cache_miss_counter_t(const cache_miss_counter_t&)            = delete;
+                cache_miss_counter_t& operator=(const cache_miss_counter_t&) = delete;
+
+                std::int64_t read() const
+                {
+                        std::int64_t value = 0;
+                        if(descriptor < 0 || ::read(descriptor, &value, sizeof(value)) != sizeof(value)) return -1;
+                        return value;
+                }
+
+                ~cache_miss_counter_t()
+                {
+                        if(descriptor >= 0) close(descriptor);
+                }
+};
+
+// Baseline: one deque behind a mutex
+template<typename DataType>
+class mutex_deque_t
+{
+        private:
+                std::mutex           lock;
+                std::deque<DataType> elements;
+
+        public:
+                using value_type = DataType;
+
+                void insert(DataType element)
+                {
+                        const std::lock_guard guard(lock);
+                        elements.push_back(std::move(element));
+                }
+
+                std::optional<DataType> extract()
+                {
+                        const std::lock_guard guard(lock);
+                        if(elements.empty()) return {};
+                        std::optional<DataType> element = std::move(elements.front());
+                        elements.pop_front();
+                        return element;
+                }
+};
+
+// Baseline: one deque behind a test-and-test-and-set spinlock that yields after a while, like the shards do when they have to wait
+template<typename DataType>
+class spinlock_deque_t
+{
+        private:
+                static constexpr std::size_t spin_attempts = 64;
+
+                std::atomic_flag     busy;
+                std::deque<DataType> elements;
+
+                void lock()
+                {
+                        while(busy.test_and_set(std::memory_order_acquire))
+                        {
+                                for(std::size_t spins = 0; busy.test(std::memory_order_relaxed); spins++)
+                                {
+                                        if(spins >= spin_attempts) std::this_thread::yield();
+                                }
+                        }
+                }
+
+                void unlock()
+                {
+                        busy.clear(std::memory_order_release);
+                }
+
+        public:
+                using value_type = DataType;
+
+                void insert(DataType element)
+                {
+                        lock();
+                        elements.push_back(std::move(element));
+                        unlock();
+                }
+
+                std::optional<DataType> extract()
+                {
+                        lock();
+                        std::optional<DataType> element;
+                        if(!elements.empty())
+                        {
+                                element = std::move(elements.front());
+                                elements.pop_front();
+                        }
+                        unlock();
+                        return element;
+                }
+};
+
+// Baseline: a single shard shared by all threads
+template<typename DataType>
+class single_queue_t
+{
+        private:
+                wait_free_bag::WaitFreeQueue<DataType> queue;
+
+        public:
+                using value_type = DataType;
+
+                void insert(DataType element)
+                {
+                        queue.enqueue(std::move(element));
+                }
+
+                std::optional<DataType> extract()
+                {
+                        return queue.dequeue();
+                }
+};
+
+struct workload_t
+{
+        public:
+                std::string_view name;
+                std::size_t      insert_percent   = 50;    // Share of inserts of threads that mix both operations
+                bool             split            = false; // Even threads only insert, odd threads only extract
+                std::size_t      burst            = 0;     // Alternate bursts of this many inserts and extracts separated by idle time
+                std::size_t      oversubscription = 1;     // Threads per requested thread
+                bool             recycle          = false; // Every operation takes an element out, touches it and puts it back
+};
+
+constexpr std::array<workload_t, 7> workloads = {{
+        {"insert-heavy", 90, false, 0, 1},
+        {"balanced", 50, false, 0, 1},
+        {"extract-heavy", 10, false, 0, 1},
+        {"producer-consumer", 50, true, 0, 1},
+        {"bursty", 50, false, 256, 1},
+        {"oversubscribed", 50, false, 0, 4},
+        {"task-recycling", 50, false, 0, 1, true},
+}};
+
+constexpr std::size_t               prefill_per_thread = 1024;
+constexpr std::chrono::microseconds burst_pause        = std::chrono::microseconds(50);
+constexpr std::array<double, 3>     quantiles          = {0.5, 0.99, 0.999};
+
+struct result_t
+{
+        public:
+                double                ops_per_second      = 0;
+                std::array<double, 3> latencies           = {};
+                double                cache_misses_per_op = -1; // Negative if the hardware counters could not be read
+};
+
+bool is_insert(const workload_t& workload, const std::size_t thread, const std::size_t operation, std::uint64_t& random)
+{
+        if(workload.split) return thread % 2 == 0;
+        if(workload.burst > 0) return (operation / workload.burst) % 2 == 0;
+
+        return wait_free_bag::xorshift(random) % 100 < workload.insert_percent;
+}
+
+// Every thread prefills the container, then all threads start together and time each single operation. Throughput counts successful and
+// failed extracts alike and includes the idle time of bursty workloads. Cache misses are counted per thread over the timed section.
+template<typename Container>
+result_t run_workload(const workload_t& workload, const std::size_t num_threads, const std::size_t operations_per_thread)
+{
+        using element_t = typename Container::value_type;
+
+        const std::size_t                     threads = num_threads * workload.oversubscription;
+        Container                             container;
+        std::vector<std::vector<double>>      latencies(threads);
+        std::chrono::steady_clock::time_point start;
+        std::chrono::steady_clock::time_point stop;
+        std::atomic_int64_t                   cache_misses = 0;
+        std::atomic_bool                      counted      = true;
+        std::atomic_size_t                    checksum     = 0;
+
+	#pragma omp parallel num_threads(threads)
+        {
+                const std::size_t    thread = static_cast<std::size_t>(omp_get_thread_num());
+                std::vector<double>& local  = latencies[thread];
+                std::uint64_t        random = (thread + 1) * 0x9E3779B97F4A7C15ULL;
+                local.reserve(operations_per_thread);
+                for(std::size_t i = 0; i < prefill_per_thread; i++) container.insert(make_element<element_t>(i));
+                const cache_miss_counter_t counter;
+                std::size_t                sum = 0;
+
+	        #pragma omp barrier
+	        #pragma omp single
+                start = std::chrono::steady_clock::now();
+
+                const std::int64_t misses_before = counter.read();
+
+                for(std::size_t i = 0; i < operations_per_thread; i++)
+                {
+                        if(workload.burst > 0 && i > 0 && i % workload.burst == 0) std::this_thread::sleep_for(burst_pause);
+
+                        const bool insert = !workload.recycle && is_insert(workload, thread, i, random);
+                        const auto op_tp0 = std::chrono::steady_clock::now();
+                        if(workload.recycle)
+                        {
+                                std::optional<element_t> element = container.extract();
+                                if(element) sum += touch(*element);
+                                container.insert(element ? std::move(*element) : make_element<element_t>(i));
+                        }
+                        else if(insert)
+                                container.insert(make_element<element_t>(i));
+                        else
+                                container.extract();
+                        const auto op_tp1 = std::chrono::steady_clock::now();
+
+                        const std::chrono::duration<double, std::nano> time = op_tp1 - op_tp0;
+                        local.push_back(time.count());
+                }
+
+                const std::int64_t misses_after = counter.read();
+                if(misses_before < 0 || misses_after < 0)
+                        counted = false;
+                else
+                        cache_misses += misses_after - misses_before;
+                checksum += sum;
+
+	        #pragma omp barrier
+	        #pragma omp single
+                stop = std::chrono::steady_clock::now();
+        }
+
+        std::vector<double> merged;
+        merged.reserve(threads * operations_per_thread);
+        for(const std::vector<double>& local: latencies) merged.insert(merged.end(), local.begin(), local.end());
+
+        result_t                            result;
+        const std::chrono::duration<double> time = stop - start;
+        result.ops_per_second                    = static_cast<double>(merged.size()) / time.count();
+        if(counted && !merged.empty()) result.cache_misses_per_op = static_cast<double>(cache_misses.load()) / static_cast<double>(merged.size());
+        if(merged.empty()) return result;
+        for(std::size_t i = 0; const double quantile: quantiles)
+        {
+                const auto nth = merged.begin() + static_cast<std::ptrdiff_t>(quantile * static_cast<double>(merged.size() - 1));
+                std::nth_element(merged.begin(), nth, merged.end());
+                result.latencies[i++] = *nth;
+        }
+        return result;
+}
+
+template<typename Container>
+void report(std::ostream& out, bool& first, const std::string_view container, const std::string_view element, const workload_t& workload, const std::size_t num_threads, const std::size_t operations_per_thread)
+{
+        const result_t result = run_workload<Container>(workload, num_threads, operations_per_thread);
+
+        out << (first ? "\n" : ",\n");
+        out << "    {\"workload\": \"" << workload.name << "\", \"container\": \"" << container << "\", \"element\": \"" << element << '"';
+        out << ", \"threads\": " << num_threads * workload.oversubscription << ", \"ops_per_second\": " << result.ops_per_second;
+        out << ", \"p50_ns\": " << result.latencies[0] << ", \"p99_ns\": " << result.latencies[1] << ", \"p999_ns\": " << result.latencies[2];
+        out << ", \"cache_misses_per_op\": ";
+        if(result.cache_misses_per_op < 0)
+                out << "null}";
+        else
+                out << result.cache_misses_per_op << '}';
+        first = false;
+}
+
+template<typename Element>
+void run_element(std::ostream& out, bool& first, const std::string_view element, const std::size_t num_threads, const std::size_t operations_per_thread)
+{
+        for(const workload_t& workload: workloads)
+        {
+                report<wait_free_bag::WaitFreeBag<Element, 16>>(out, first, "wait-free bag", element, workload, num_threads, operations_per_thread);
+                report<wait_free_bag::WaitFreeBag<Element, 16, wait_free_bag::SegmentedQueue<Element>>>(out, first, "segmented bag", element, workload, num_threads, operations_per_thread);
+                report<wait_free_bag::WaitFreeBag<Element, 16, wait_free_bag::TreiberStack<Element>>>(out, first, "stack bag", element, workload, num_threads, operations_per_thread);
+                report<single_queue_t<Element>>(out, first, "single queue", element, workload, num_threads, operations_per_thread);
+                report<mutex_deque_t<Element>>(out, first, "mutex deque", element, workload, num_threads, operations_per_thread);
+                report<spinlock_deque_t<Element>>(out, first, "spinlock deque", element, workload, num_threads, operations_per_thread);
+        }
+}
+
+int main(int argc, char** argv)
+{
+        if(argc <= 1)
+        {
+                std::println("[ERROR] Incorrect usage...");
+                std::println("Usage: benchmark <operations per thread> [number of threads]");
+                std::exit(-1);
+        }
+
+        std::stringstream ss(argv[1]);
+        std::size_t       operations_per_thread = 0;
+        ss >> operations_per_thread;
+
+        std::size_t num_threads = std::max(1U, std::thread::hardware_concurrency());
+        if(argc > 2)
+        {
+                std::stringstream threads_ss(argv[2]);
+                threads_ss >> num_threads;
+        }
+
+        // One JSON document on stdout, see plotting/plots/plot.py
+        bool first = true;
+        std::cout << "{\n  \"operations_per_thread\": " << operations_per_thread << ",\n  \"results\": [";
+        run_element<payload_t<4>>(std::cout, first, "4 B", num_threads, operations_per_thread);
+        run_element<payload_t<64>>(std::cout, first, "64 B", num_threads, operations_per_thread);
+        run_element<payload_t<200>>(std::cout, first, "200 B", num_threads, operations_per_thread);
+        run_element<payload_t<1024>>(std::cout, first, "1 KB", num_threads, operations_per_thread);
+        run_element<std::unique_ptr<payload_t<200>>>(std::cout, first, "unique_ptr to 200 B", num_threads, operations_per_thread);
+        std::cout << "\n  ]\n}" << std::endl;
+}
@@ -1,7 +1,17 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <ctime>
+#include <limits>
+#include <memory>
 #include <omp.h>
+#include <optional>
 #include <print>
 #include <sstream>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
 #include <vector>
 #include <wait_free_bag.hpp>
 
@@ -27,6 +37,37 @@ void wait_free_insert(auto& bag, const std::size_t num_threads, const std::size_
         }
 }
 
+// Inserts into a bounded bag and returns how many elements every shard refused
+std::size_t bounded_insert(auto& bag, const std::size_t num_threads, const std::size_t elements_per_thread)
+{
+        std::size_t rejected = 0;
+
+	#pragma omp parallel for reduction(+ : rejected)
+        for(std::size_t i = 0; i < num_threads; i++)
+        {
+                for(std::size_t j = 0; j < elements_per_thread; j++)
+                {
+                        if(!bag.try_insert((i * elements_per_thread) + j)) rejected++;
+                }
+        }
+        return rejected;
+}
+
+void wait_free_batch_insert(auto& bag, const std::size_t num_threads, const std::size_t elements_per_thread, const std::size_t batch)
+{
+	#pragma omp parallel for
+        for(std::size_t i = 0; i < num_threads; i++)
+        {
+                std::vector<std::size_t> buffer(batch);
+                for(std::size_t j = 0; j < elements_per_thread; j += batch)
+                {
+                        const std::size_t count = std::min(batch, elements_per_thread - j);
+                        for(std::size_t k = 0; k < count; k++) buffer[k] = (i * elements_per_thread) + j + k;
+                        bag.insert_range(buffer.begin(), buffer.begin() + static_cast<std::ptrdiff_t>(count));
+                }
+        }
+}
+
 void lock_based_for_all(auto& vec)
 {
         auto foo = [](std::size_t& value)
@@ -49,6 +90,16 @@ void wait_free_for_all(auto& bag)
         bag.for_all(foo);
 }
 
+void parallel_for_all(auto& bag, const std::size_t num_threads)
+{
+        auto foo = [](std::size_t& value)
+        {
+                value = value * -1;
+        };
+
+        bag.for_all_par(foo, num_threads);
+}
+
 void lock_based_extract(auto& vec)
 {
 	#pragma omp parallel for
@@ -67,16 +118,244 @@ void wait_free_extract(auto& bag, const std::size_t num_threads)
 	#pragma omp parallel for
         for(std::size_t i = 0; i < num_threads; i++)
         {
-                while(bag.size() > 0) bag.extract();
+                while(bag.size_approx() > 0) bag.extract();
         }
 }
 
+void wait_free_batch_extract(auto& bag, const std::size_t num_threads, const std::size_t batch)
+{
+	#pragma omp parallel for
+        for(std::size_t i = 0; i < num_threads; i++)
+        {
+                std::vector<std::size_t> buffer(batch);
+                while(bag.size_approx() > 0) bag.extract_n(buffer.begin(), batch);
+        }
+}
+
+// Paced producers and as many consumers that either poll extract or park in extract_wait, returns wall clock and process CPU seconds
+std::array<double, 2> handoff_benchmark(auto& bag, const std::size_t num_threads, const std::size_t elements_per_producer, const bool blocking)
+{
+        const std::size_t pairs = std::max(num_threads / 2, 1UZ);
+
+        const std::clock_t cpu0 = std::clock();
+        const auto         tp0  = std::chrono::high_resolution_clock::now();
+	#pragma omp parallel for num_threads(2 * pairs) schedule(static, 1)
+        for(std::size_t i = 0; i < 2 * pairs; i++)
+        {
+                for(std::size_t j = 0; j < elements_per_producer; j++)
+                {
+                        if(i % 2 == 0)
+                        {
+                                bag.insert(j);
+                                if(j % 256 == 255) std::this_thread::sleep_for(std::chrono::microseconds(100));
+                        }
+                        else if(blocking)
+                                bag.extract_wait();
+                        else
+                        {
+                                while(!bag.extract());
+                        }
+                }
+        }
+        const auto         tp1  = std::chrono::high_resolution_clock::now();
+        const std::clock_t cpu1 = std::clock();
+
+        const std::chrono::duration<double> time = tp1 - tp0;
+        return {time.count(), static_cast<double>(cpu1 - cpu0) / CLOCKS_PER_SEC};
+}
+
+// Per operation latency of alternating inserts and extracts in nanoseconds, returns the 50th, 99th and 99.9th percentile
+std::array<double, 3> latency_percentiles(auto& bag, const std::size_t num_threads, const std::size_t operations_per_thread)
+{
+        std::vector<double> latencies(num_threads * operations_per_thread);
+
+	#pragma omp parallel for
+        for(std::size_t i = 0; i < num_threads; i++)
+        {
+                for(std::size_t j = 0; j < operations_per_thread; j++)
+                {
+                        const auto op_tp0 = std::chrono::steady_clock::now();
+                        if(j % 2 == 0)
+                                bag.insert(j);
+                        else
+                                bag.extract();
+                        const auto op_tp1 = std::chrono::steady_clock::now();
+
+                        const std::chrono::duration<double, std::nano> time = op_tp1 - op_tp0;
+                        latencies[(i * operations_per_thread) + j]          = time.count();
+                }
+        }
+        while(bag.size_approx() > 0) bag.extract();
+
+        std::array<double, 3> percentiles = {};
+        if(latencies.empty()) return percentiles;
+        for(std::size_t i = 0; const double quantile: {0.5, 0.99, 0.999})
+        {
+                const auto nth = latencies.begin() + static_cast<std::ptrdiff_t>(quantile * static_cast<double>(latencies.size() - 1));
+                std::nth_element(latencies.begin(), nth, latencies.end());
+                percentiles[i++] = *nth;
+        }
+        return percentiles;
+}
+
+// Seconds of the OpenMP for_all and of for_all_par over a bag filled by all threads, then over a bag filled by a single thread where
+// every element ends up in the same shard
+std::array<double, 4> traversal_benchmark(const std::size_t num_threads, const std::size_t num_shards, const std::size_t elements_per_thread)
+{
+        std::array<double, 4> times = {};
+        for(std::size_t i = 0; const bool skewed: {false, true})
+        {
+                wait_free_bag::WaitFreeBag<std::size_t, 16> bag(num_shards);
+                if(skewed)
+                        wait_free_insert(bag, 1, num_threads * elements_per_thread);
+                else
+                        wait_free_insert(bag, num_threads, elements_per_thread);
+
+                const auto tp0 = std::chrono::high_resolution_clock::now();
+                wait_free_for_all(bag);
+                const auto tp1 = std::chrono::high_resolution_clock::now();
+                parallel_for_all(bag, num_threads);
+                const auto tp2 = std::chrono::high_resolution_clock::now();
+
+                const std::chrono::duration<double> omp_time      = tp1 - tp0;
+                const std::chrono::duration<double> parallel_time = tp2 - tp1;
+                times[i++]                                        = omp_time.count();
+                times[i++]                                        = parallel_time.count();
+        }
+        return times;
+}
+
+// Sharded bag that keeps its element count either in one shared atomic or in one cache line padded atomic per shard. Shards and home
+// assignment are the same in both, so the two only differ in which counter insert and extract update.
+template<bool Global>
+class counted_bag_t
+{
+        private:
+                struct alignas(64) counter_t
+                {
+                        public:
+                                std::atomic_int_least64_t value = 0;
+                };
+
+                struct alignas(64) shard_t
+                {
+                        public:
+                                wait_free_bag::WaitFreeQueue<std::size_t> queue;
+                                counter_t                                 counter;
+                };
+
+                const std::size_t                shard_count;
+                const std::unique_ptr<shard_t[]> shards;
+                counter_t                        global;
+
+                std::atomic_int_least64_t& counter(const std::size_t shard)
+                {
+                        return Global ? global.value : shards[shard].counter.value;
+                }
+
+                std::size_t home() const
+                {
+                        return static_cast<std::size_t>(omp_get_thread_num()) % shard_count;
+                }
+
+        public:
+                explicit counted_bag_t(const std::size_t shards): shard_count(shards), shards(new shard_t[shards]) {}
+
+                void insert(const std::size_t element)
+                {
+                        const std::size_t shard = home();
+                        shards[shard].queue.enqueue(element);
+                        counter(shard).fetch_add(1, std::memory_order_relaxed);
+                }
+
+                std::optional<std::size_t> extract()
+                {
+                        const std::size_t start = home();
+                        for(std::size_t i = 0; i < shard_count; i++)
+                        {
+                                const std::size_t          shard   = (start + i) % shard_count;
+                                std::optional<std::size_t> element = shards[shard].queue.dequeue();
+                                if(element)
+                                {
+                                        counter(shard).fetch_sub(1, std::memory_order_relaxed);
+                                        return element;
+                                }
+                        }
+                        return {};
+                }
+
+                std::size_t size_approx() const
+                {
+                        std::int_least64_t total = 0;
+                        if constexpr(Global)
+                                total = global.value.load(std::memory_order_relaxed);
+                        else
+                        {
+                                for(std::size_t i = 0; i < shard_count; i++) total += shards[i].counter.value.load(std::memory_order_relaxed);
+                        }
+                        return total > 0 ? static_cast<std::size_t>(total) : 0;
+                }
+};
+
+// Seconds for alternating inserts and extracts followed by draining the bag, with every thread updating the element count each time
+template<bool Global>
+double counter_benchmark(const std::size_t num_threads, const std::size_t num_shards, const std::size_t elements_per_thread)
+{
+        counted_bag_t<Global> bag(num_shards);
+
+        const auto tp0 = std::chrono::high_resolution_clock::now();
+	#pragma omp parallel for num_threads(num_threads)
+        for(std::size_t i = 0; i < num_threads; i++)
+        {
+                for(std::size_t j = 0; j < elements_per_thread; j++)
+                {
+                        bag.insert((i * elements_per_thread) + j);
+                        if(j % 2 == 1) bag.extract();
+                }
+                while(bag.size_approx() > 0) bag.extract();
+        }
+        const auto tp1 = std::chrono::high_resolution_clock::now();
+
+        const std::chrono::duration<double> time = tp1 - tp0;
+        return time.count();
+}
+
+// Seconds to insert and to extract all elements through a bag in a memfd (see shared_bag.hpp), NaN if no memfd can be created
+std::array<double, 2> shared_benchmark(const std::size_t num_threads, const std::size_t elements_per_thread)
+{
+        const int fd = memfd_create("evaluate", 0);
+        if(fd < 0) return {std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::quiet_NaN()};
+
+        std::array<double, 2> times = {};
+        try
+        {
+                wait_free_bag::SharedBag<std::size_t, 16> bag(fd, std::max(num_threads * elements_per_thread, 1UZ));
+
+                const auto tp0 = std::chrono::high_resolution_clock::now();
+                wait_free_insert(bag, num_threads, elements_per_thread);
+                const auto tp1 = std::chrono::high_resolution_clock::now();
+                wait_free_extract(bag, num_threads);
+                const auto tp2 = std::chrono::high_resolution_clock::now();
+
+                const std::chrono::duration<double> insert_time  = tp1 - tp0;
+                const std::chrono::duration<double> extract_time = tp2 - tp1;
+                times                                            = {insert_time.count(), extract_time.count()};
+        }
+        catch(...)
+        {
+                close(fd);
+                throw;
+        }
+        close(fd);
+        return times;
+}
+
 int main(int argc, char** argv)
 {
         if(argc <= 1)
         {
                 std::println("[ERROR] Incorrect usage...");
-                std::println("Usage: evaluate <number of elements>");
+                std::println("Usage: evaluate <number of elements> [number of shards]");
                 std::exit(-1);
         }
 
@@ -89,8 +368,23 @@ int main(int argc, char** argv)
         ss >> num_elements;
         const std::size_t elements_per_thread = num_elements / num_threads;
 
-        wait_free_bag::WaitFreeBag<std::size_t, 16> bag;
-        std::vector<std::size_t>                    vec;
+        std::size_t num_shards = 16;
+        if(argc > 2)
+        {
+                std::stringstream shards_ss(argv[2]);
+                shards_ss >> num_shards;
+        }
+
+        wait_free_bag::WaitFreeBag<std::size_t, 16>                                                                                                                                        bag(num_shards);
+        wait_free_bag::WaitFreeBag<std::size_t, 16>                                                                                                                                        adaptive_bag(num_shards, true);
+        wait_free_bag::WaitFreeBag<std::size_t, 16, wait_free_bag::WaitFreeQueue<std::size_t, wait_free_bag::NodePool, wait_free_bag::HazardPointers, wait_free_bag::PackedTaggedPointer>> packed_bag(num_shards);
+        wait_free_bag::WaitFreeBag<std::size_t, 16, wait_free_bag::WaitFreeQueue<std::size_t, wait_free_bag::HeapAllocator>>                                                               heap_bag;
+        wait_free_bag::WaitFreeBag<std::size_t, 16, wait_free_bag::WaitFreeQueue<std::size_t, wait_free_bag::NodePool, wait_free_bag::NoReclamation>>                                      unsafe_bag;
+        wait_free_bag::WaitFreeBag<std::size_t, 16, wait_free_bag::WaitFreeQueue<std::size_t, wait_free_bag::NodePool, wait_free_bag::EpochReclamation>>                                   epoch_bag;
+        wait_free_bag::WaitFreeBag<std::size_t, 16, wait_free_bag::SegmentedQueue<std::size_t>>                                                                                            segmented_bag;
+        wait_free_bag::WaitFreeBag<std::size_t, 64, wait_free_bag::WorkStealingDeque<std::size_t>>                                                                                         work_stealing_bag;
+        wait_free_bag::WaitFreeBag<std::size_t, 16, wait_free_bag::BoundedRing<std::size_t, 1 << 17>>                                                                                      ring_bag(num_shards);
+        std::vector<std::size_t>                                                                                                                                                           vec;
 
         const auto tp0 = std::chrono::high_resolution_clock::now();
         lock_based_insert(vec, num_threads, elements_per_thread);
@@ -105,6 +399,79 @@ int main(int argc, char** argv)
         const auto tp5 = std::chrono::high_resolution_clock::now();
         wait_free_extract(bag, num_threads);
         const auto tp6 = std::chrono::high_resolution_clock::now();
+        wait_free_insert(heap_bag, num_threads, elements_per_thread);
+        const auto tp7 = std::chrono::high_resolution_clock::now();
+        wait_free_extract(heap_bag, num_threads);
+        const auto tp8 = std::chrono::high_resolution_clock::now();
+        wait_free_insert(unsafe_bag, num_threads, elements_per_thread);
+        const auto tp9 = std::chrono::high_resolution_clock::now();
+        wait_free_extract(unsafe_bag, num_threads);
+        const auto tp10 = std::chrono::high_resolution_clock::now();
+        wait_free_insert(epoch_bag, num_threads, elements_per_thread);
+        const auto tp11 = std::chrono::high_resolution_clock::now();
+        wait_free_extract(epoch_bag, num_threads);
+        const auto tp12 = std::chrono::high_resolution_clock::now();
+        wait_free_insert(segmented_bag, num_threads, elements_per_thread);
+        const auto tp13 = std::chrono::high_resolution_clock::now();
+        wait_free_for_all(segmented_bag);
+        const auto tp14 = std::chrono::high_resolution_clock::now();
+        wait_free_extract(segmented_bag, num_threads);
+        const auto tp15 = std::chrono::high_resolution_clock::now();
+        wait_free_insert(work_stealing_bag, num_threads, elements_per_thread);
+        const auto tp16 = std::chrono::high_resolution_clock::now();
+        wait_free_extract(work_stealing_bag, num_threads);
+        const auto tp17 = std::chrono::high_resolution_clock::now();
+        wait_free_insert(adaptive_bag, num_threads, elements_per_thread);
+        const auto tp18 = std::chrono::high_resolution_clock::now();
+        wait_free_extract(adaptive_bag, num_threads);
+        const auto tp19 = std::chrono::high_resolution_clock::now();
+        wait_free_insert(packed_bag, num_threads, elements_per_thread);
+        const auto tp20 = std::chrono::high_resolution_clock::now();
+        wait_free_extract(packed_bag, num_threads);
+        const auto tp21 = std::chrono::high_resolution_clock::now();
+        const std::size_t ring_rejected = bounded_insert(ring_bag, num_threads, elements_per_thread);
+        const auto        tp22          = std::chrono::high_resolution_clock::now();
+        wait_free_for_all(ring_bag);
+        const auto tp23 = std::chrono::high_resolution_clock::now();
+        wait_free_extract(ring_bag, num_threads);
+        const auto tp24 = std::chrono::high_resolution_clock::now();
+
+        const std::array<double, 2> shared_times = shared_benchmark(num_threads, elements_per_thread);
+
+        // Throughput in elements per second of the bulk APIs for batch sizes of 1, 16 and 256
+        std::array<double, 3> batch_insert_throughput  = {};
+        std::array<double, 3> batch_extract_throughput = {};
+        for(std::size_t i = 0; const std::size_t batch: {1UZ, 16UZ, 256UZ})
+        {
+                const auto batch_tp0 = std::chrono::high_resolution_clock::now();
+                wait_free_batch_insert(bag, num_threads, elements_per_thread, batch);
+                const auto batch_tp1 = std::chrono::high_resolution_clock::now();
+                wait_free_batch_extract(bag, num_threads, batch);
+                const auto batch_tp2 = std::chrono::high_resolution_clock::now();
+
+                const std::chrono::duration<double> insert_time  = batch_tp1 - batch_tp0;
+                const std::chrono::duration<double> extract_time = batch_tp2 - batch_tp1;
+                batch_insert_throughput[i]                       = static_cast<double>(num_threads * elements_per_thread) / insert_time.count();
+                batch_extract_throughput[i]                      = static_cast<double>(num_threads * elements_per_thread) / extract_time.count();
+                i++;
+        }
+
+        const std::size_t counter_threads      = std::max(num_threads, 16UZ);
+        const double      single_counter_time  = counter_benchmark<true>(counter_threads, num_shards, num_elements / counter_threads);
+        const double      sharded_counter_time = counter_benchmark<false>(counter_threads, num_shards, num_elements / counter_threads);
+
+        // Tail latency of the lock-free shard against the wait-free one, both with a single shard to provoke contention
+        wait_free_bag::WaitFreeBag<std::size_t, 1>                                           lock_free_latency_bag;
+        wait_free_bag::WaitFreeBag<std::size_t, 1, wait_free_bag::HelpingQueue<std::size_t>> wait_free_latency_bag;
+        const std::array<double, 3>                                                          lock_free_latency = latency_percentiles(lock_free_latency_bag, num_threads, elements_per_thread);
+        const std::array<double, 3>                                                          wait_free_latency = latency_percentiles(wait_free_latency_bag, num_threads, elements_per_thread);
+
+        // Idle consumers spinning on extract against consumers parked in extract_wait
+        const std::array<double, 2> polling_handoff  = handoff_benchmark(bag, num_threads, elements_per_thread / 4, false);
+        const std::array<double, 2> blocking_handoff = handoff_benchmark(bag, num_threads, elements_per_thread / 4, true);
+
+        // Chunked traversal against one OpenMP thread per shard, on balanced and on skewed shards
+        const std::array<double, 4> traversal_times = traversal_benchmark(num_threads, num_shards, elements_per_thread);
 
         const std::chrono::duration<double> lock_based_insert_time  = tp1 - tp0;
         const std::chrono::duration<double> wait_free_insert_time   = tp2 - tp1;
@@ -112,8 +479,39 @@ int main(int argc, char** argv)
         const std::chrono::duration<double> wait_free_for_all_time  = tp4 - tp3;
         const std::chrono::duration<double> lock_based_extract_time = tp5 - tp4;
         const std::chrono::duration<double> wait_free_extract_time  = tp6 - tp5;
+        const std::chrono::duration<double> heap_insert_time        = tp7 - tp6;
+        const std::chrono::duration<double> heap_extract_time       = tp8 - tp7;
+        const std::chrono::duration<double> unsafe_insert_time      = tp9 - tp8;
+        const std::chrono::duration<double> unsafe_extract_time     = tp10 - tp9;
+        const std::chrono::duration<double> epoch_insert_time       = tp11 - tp10;
+        const std::chrono::duration<double> epoch_extract_time      = tp12 - tp11;
+        const std::chrono::duration<double> segmented_insert_time   = tp13 - tp12;
+        const std::chrono::duration<double> segmented_for_all_time  = tp14 - tp13;
+        const std::chrono::duration<double> segmented_extract_time  = tp15 - tp14;
+        const std::chrono::duration<double> stealing_insert_time    = tp16 - tp15;
+        const std::chrono::duration<double> stealing_extract_time   = tp17 - tp16;
+        const std::chrono::duration<double> adaptive_insert_time    = tp18 - tp17;
+        const std::chrono::duration<double> adaptive_extract_time   = tp19 - tp18;
+        const std::chrono::duration<double> packed_insert_time      = tp20 - tp19;
+        const std::chrono::duration<double> packed_extract_time     = tp21 - tp20;
+        const std::chrono::duration<double> ring_insert_time        = tp22 - tp21;
+        const std::chrono::duration<double> ring_for_all_time       = tp23 - tp22;
+        const std::chrono::duration<double> ring_extract_time       = tp24 - tp23;
 
-        std::println("{},{},{},{},{},{},{},{},{},{},{},{}",
+        // Column names, collect.sh cuts columns by position and plot.py reads the raw files by name
+        std::println("threads,elements,elements_per_thread,lock_based_insert_s,wait_free_insert_s,lock_based_for_all_s,wait_free_for_all_s,lock_based_extract_s,wait_free_extract_s,"
+                     "insert_speedup,for_all_speedup,extract_speedup,"
+                     "heap_insert_s,heap_extract_s,heap_insert_ratio,heap_extract_ratio,unsafe_insert_s,unsafe_extract_s,epoch_insert_s,epoch_extract_s,hazard_extract_overhead,epoch_extract_overhead,"
+                     "segmented_insert_s,segmented_for_all_s,segmented_extract_s,segmented_insert_speedup,segmented_for_all_speedup,segmented_extract_speedup,"
+                     "batch_1_inserts_per_s,batch_16_inserts_per_s,batch_256_inserts_per_s,batch_1_extracts_per_s,batch_16_extracts_per_s,batch_256_extracts_per_s,"
+                     "stealing_insert_s,stealing_extract_s,stealing_insert_speedup,stealing_extract_speedup,counter_threads,global_counter_s,sharded_counter_s,sharded_counter_speedup,"
+                     "shards,adaptive_active_shards,adaptive_insert_s,adaptive_extract_s,adaptive_insert_speedup,adaptive_extract_speedup,"
+                     "lock_free_p50_ns,lock_free_p99_ns,lock_free_p999_ns,wait_free_p50_ns,wait_free_p99_ns,wait_free_p999_ns,"
+                     "packed_insert_s,packed_extract_s,packed_insert_ratio,packed_extract_ratio,polling_handoff_s,polling_handoff_cpu_s,blocking_handoff_s,blocking_handoff_cpu_s,"
+                     "omp_for_all_s,parallel_for_all_s,skewed_omp_for_all_s,skewed_parallel_for_all_s,parallel_for_all_speedup,skewed_parallel_for_all_speedup,"
+                     "ring_insert_s,ring_for_all_s,ring_extract_s,ring_insert_ratio,ring_extract_ratio,ring_rejected,numa_nodes,"
+                     "shared_insert_s,shared_extract_s,shared_insert_ratio,shared_extract_ratio");
+        std::println("{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{}",
                      num_threads,
                      num_elements,
                      elements_per_thread,
@@ -125,5 +523,72 @@ int main(int argc, char** argv)
                      wait_free_extract_time.count(),
                      lock_based_insert_time / wait_free_insert_time,
                      lock_based_for_all_time / wait_free_for_all_time,
-                     lock_based_extract_time / wait_free_extract_time);
+                     lock_based_extract_time / wait_free_extract_time,
+                     heap_insert_time.count(),
+                     heap_extract_time.count(),
+                     heap_insert_time / wait_free_insert_time,
+                     heap_extract_time / wait_free_extract_time,
+                     unsafe_insert_time.count(),
+                     unsafe_extract_time.count(),
+                     epoch_insert_time.count(),
+                     epoch_extract_time.count(),
+                     wait_free_extract_time / unsafe_extract_time,
+                     epoch_extract_time / unsafe_extract_time,
+                     segmented_insert_time.count(),
+                     segmented_for_all_time.count(),
+                     segmented_extract_time.count(),
+                     lock_based_insert_time / segmented_insert_time,
+                     lock_based_for_all_time / segmented_for_all_time,
+                     lock_based_extract_time / segmented_extract_time,
+                     batch_insert_throughput[0],
+                     batch_insert_throughput[1],
+                     batch_insert_throughput[2],
+                     batch_extract_throughput[0],
+                     batch_extract_throughput[1],
+                     batch_extract_throughput[2],
+                     stealing_insert_time.count(),
+                     stealing_extract_time.count(),
+                     lock_based_insert_time / stealing_insert_time,
+                     lock_based_extract_time / stealing_extract_time,
+                     counter_threads,
+                     single_counter_time,
+                     sharded_counter_time,
+                     single_counter_time / sharded_counter_time,
+                     num_shards,
+                     adaptive_bag.active_shards(),
+                     adaptive_insert_time.count(),
+                     adaptive_extract_time.count(),
+                     lock_based_insert_time / adaptive_insert_time,
+                     lock_based_extract_time / adaptive_extract_time,
+                     lock_free_latency[0],
+                     lock_free_latency[1],
+                     lock_free_latency[2],
+                     wait_free_latency[0],
+                     wait_free_latency[1],
+                     wait_free_latency[2],
+                     packed_insert_time.count(),
+                     packed_extract_time.count(),
+                     packed_insert_time / wait_free_insert_time,
+                     packed_extract_time / wait_free_extract_time,
+                     polling_handoff[0],
+                     polling_handoff[1],
+                     blocking_handoff[0],
+                     blocking_handoff[1],
+                     traversal_times[0],
+                     traversal_times[1],
+                     traversal_times[2],
+                     traversal_times[3],
+                     traversal_times[0] / traversal_times[1],
+                     traversal_times[2] / traversal_times[3],
+                     ring_insert_time.count(),
+                     ring_for_all_time.count(),
+                     ring_extract_time.count(),
+                     ring_insert_time / wait_free_insert_time,
+                     ring_extract_time / wait_free_extract_time,
+                     ring_rejected,
+                     bag.numa_nodes(),
+                     shared_times[0],
+                     shared_times[1],
+                     shared_times[0] / wait_free_insert_time.count(),
+                     shared_times[1] / wait_free_extract_time.count());
 }
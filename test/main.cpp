@@ -1,6 +1,21 @@
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <memory>
 #include <omp.h>
+#include <optional>
+#include <ranges>
+#include <stdexcept>
 #include <syncstream>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
 #include <vector>
 #include <wait_free_bag.hpp>
 
@@ -38,25 +53,432 @@ void for_all_test(auto& bag)
         bag.for_all(printer);
 }
 
+void traversal_test(auto& bag)
+{
+        auto doubler = [](int& value)
+        {
+                value *= 2;
+        };
+        auto halver = [](int& value)
+        {
+                value /= 2;
+        };
+        bag.for_all_par(doubler);
+        bag.for_all_par(halver, 3);
+
+        std::atomic_long parallel_sum = 0;
+        std::as_const(bag).for_all_par(
+                [&parallel_sum](const int& value)
+                {
+                        parallel_sum += value;
+                });
+
+        long sequential_sum = 0;
+        for(const int value: std::as_const(bag)) sequential_sum += value;
+        std::cout << "Sum " << parallel_sum << " / " << sequential_sum << '\n';
+}
+
+// Batches race with single inserts and extracts on the same two shards, extracts that find a shard empty help its tail along. Afterwards
+// every traversal has to visit every element that is left.
+void range_traversal_test()
+{
+        wait_free_bag::WaitFreeBag<int, 2> bag;
+
+	#pragma omp parallel for
+        for(int i = 0; i < 64; i++)
+        {
+                std::vector<int> batch;
+                for(int j = 0; j < 16; j++) batch.push_back((i * 16) + j);
+                if(i % 2 == 0)
+                        bag.insert_range(batch.begin(), batch.end());
+                else
+                {
+                        for(const int value: batch)
+                        {
+                                bag.insert(value);
+                                bag.extract();
+                        }
+                }
+        }
+
+        std::atomic_long visited = 0;
+        std::as_const(bag).for_all_par(
+                [&visited](const int&)
+                {
+                        visited++;
+                });
+        long iterated = 0;
+        for(const int value: std::as_const(bag)) iterated += value >= 0 ? 1 : 0;
+        std::cout << "Range traversal " << visited << " / " << iterated << " / " << bag.size() << '\n';
+}
+
+// Two threads insert into rings while a third traverses them, cells that are claimed but not yet published must never be visited
+void ring_traversal_test()
+{
+        wait_free_bag::WaitFreeBag<int, 4, wait_free_bag::BoundedRing<int, 1024>> bag;
+        std::atomic_int                                                           inserters = 2;
+        std::atomic_long                                                          unwritten = 0;
+
+	#pragma omp parallel sections num_threads(3)
+        {
+	        #pragma omp section
+                {
+                        for(int i = 0; i < 1000; i++) bag.try_insert(7);
+                        inserters--;
+                }
+	        #pragma omp section
+                {
+                        for(int i = 0; i < 1000; i++) bag.try_insert(7);
+                        inserters--;
+                }
+	        #pragma omp section
+                do
+                {
+                        for(const int value: std::as_const(bag)) unwritten += value != 7 ? 1 : 0;
+                        std::as_const(bag).for_all_par(
+                                [&unwritten](const int& value)
+                                {
+                                        unwritten += value != 7 ? 1 : 0;
+                                },
+                                2);
+                } while(inserters > 0);
+        }
+        std::cout << "Ring traversal during inserts, " << unwritten << " unwritten cells visited, size " << bag.size() << '\n';
+}
+
+// The executor refuses the second task, the traversal waits for the task it did start and passes the exception on
+void throwing_executor_test()
+{
+        wait_free_bag::WaitFreeBag<int, 4> bag;
+        for(int i = 0; i < 64; i++) bag.insert(i);
+
+        std::vector<std::jthread> threads;
+        std::atomic_long          visited = 0;
+        bool                      threw   = false;
+        threads.reserve(4);
+        try
+        {
+                std::as_const(bag).for_all(
+                        [&threads](std::function<void()> task)
+                        {
+                                if(!threads.empty()) throw std::runtime_error("Executor is full\n");
+                                threads.emplace_back(std::move(task));
+                        },
+                        [&visited](const int&)
+                        {
+                                visited++;
+                        },
+                        4);
+        }
+        catch(const std::runtime_error&)
+        {
+                threw = true;
+        }
+        std::cout << "Executor " << (threw ? "threw" : "did not throw") << ", " << visited << " visited\n";
+}
+
 void size_test(const auto& bag)
 {
         std::cout << bag.size() << '\n';
 }
 
-int main()
+void stats_test(const auto& bag)
 {
-        wait_free_bag::WaitFreeBag<int, 16> bag;
+        const wait_free_bag::bag_stats_t stats = bag.stats();
+        std::cout << (stats.enabled ? "Instrumented" : "Not instrumented") << ", " << stats.active_shards << " active shards on " << stats.numa_nodes << " NUMA nodes, " << stats.extracts << " extracts\n";
+        std::cout << "CAS " << stats.total.cas_failures << " / " << stats.total.cas_attempts << " failed, " << stats.total.loop_iterations << " iterations, ";
+        std::cout << stats.total.tail_helps << " tail helps, " << stats.total.empty_probes << " empty probes, occupancy " << stats.total.occupancy << '\n';
+}
+
+// Move-only elements without a default constructor go through insert, emplace, for_all, extract and extract_n without a single copy
+template<typename Bag>
+void move_only_test()
+{
+        Bag bag;
+        bag.insert(std::make_unique<int>(1));
+        bag.emplace(new int(2));
+        std::vector<std::unique_ptr<int>> batch;
+        batch.push_back(std::make_unique<int>(3));
+        batch.push_back(std::make_unique<int>(4));
+        bag.insert_range(std::make_move_iterator(batch.begin()), std::make_move_iterator(batch.end()));
+
+        auto incrementer = [](std::unique_ptr<int>& value)
+        {
+                ++*value;
+        };
+	#pragma omp parallel
+        bag.for_all(incrementer);
+
+        int sum = 0;
+        for(const std::unique_ptr<int>& value: std::as_const(bag)) sum += *value;
+
+        std::vector<std::unique_ptr<int>> out(4);
+        std::size_t                       extracted = bag.extract_n(out.begin(), 2);
+        while(std::optional<std::unique_ptr<int>> element = bag.extract()) out[extracted++] = std::move(*element);
+        bag.insert(std::make_unique<int>(5)); // Still owned by the bag when it goes out of scope
+        std::cout << "Move-only sum " << sum << ", extracted " << extracted << '\n';
+}
+
+// Counts its live instances, copies throw once copies_left runs out
+struct fragile_t
+{
+        public:
+                static inline int live        = 0;
+                static inline int copies_left = 0;
+
+                int value = 0;
+
+                explicit fragile_t(const int value): value(value)
+                {
+                        live++;
+                }
+
+                fragile_t(const fragile_t& other): value(other.value)
+                {
+                        if(copies_left-- == 0) throw std::runtime_error("Copy failed\n");
+                        live++;
+                }
+
+                fragile_t(fragile_t&& other) noexcept: value(other.value)
+                {
+                        live++;
+                }
+
+                fragile_t& operator=(const fragile_t&) = default;
+                fragile_t& operator=(fragile_t&&)      = default;
+
+                ~fragile_t()
+                {
+                        live--;
+                }
+};
+
+// The fourth copy of a batch throws, the elements copied before it must not stay behind in the bag or in the half built chain
+template<typename Bag>
+void throwing_range_test()
+{
+        Bag                    bag;
+        std::vector<fragile_t> batch;
+        for(int i = 0; i < 6; i++) batch.emplace_back(i);
 
+        fragile_t::copies_left = 3;
+        bool threw             = false;
+        try
+        {
+                bag.insert_range(batch.begin(), batch.end());
+        }
+        catch(const std::runtime_error&)
+        {
+                threw = true;
+        }
+        std::cout << "Throwing range " << (threw ? "threw" : "did not throw") << ", size " << bag.size() << ", " << fragile_t::live - 6 << " copies left over\n";
+}
+
+// Four threads share two owned shards, the two threads left without a shard insert into the overflow queue
+void overflow_test()
+{
+        wait_free_bag::WaitFreeBag<int, 2, wait_free_bag::WorkStealingDeque<int>> bag;
+
+	#pragma omp parallel for num_threads(4) schedule(static, 1)
+        for(int i = 0; i < 4; i++)
+        {
+                const std::vector<int> batch(8, 1);
+                bag.insert(1);
+                bag.insert_range(batch.begin(), batch.end());
+        }
+
+        long traversed = 0;
+        for(const int value: bag) traversed += value;
+        const std::size_t size      = bag.size();
+        int               extracted = 0;
+        while(bag.extract()) extracted++;
+        std::cout << "Overflow traversed " << traversed << ", size " << size << ", extracted " << extracted << '\n';
+}
+
+// Two rings of four cells take eight elements, the ninth is refused without throwing
+void bounded_test()
+{
+        wait_free_bag::WaitFreeBag<int, 2, wait_free_bag::BoundedRing<int, 4>> bag;
+        int                                                                    accepted = 0;
+        for(int i = 0; i < 8; i++) accepted += bag.try_insert(i) ? 1 : 0;
+        const bool refused = !bag.try_insert(8);
+        bag.extract();
+        const bool reused = bag.try_insert(9);
+        std::cout << "Bounded accepted " << accepted << (refused ? ", refused when full" : ", accepted when full") << (reused ? ", reused freed cell" : ", no free cell") << ", size " << bag.size() << '\n';
+}
+
+// A batch of six overflows the home ring into the other one, the two inserts after it fill the bag and only the ninth element throws
+void bounded_spill_test()
+{
+        wait_free_bag::WaitFreeBag<int, 2, wait_free_bag::BoundedRing<int, 4>> bag;
+        const std::vector<int>                                                 batch(6, 1);
+        bag.insert_range(batch.begin(), batch.end());
+        bag.insert(1);
+        bag.emplace(1);
+
+        bool threw = false;
+        try
+        {
+                bag.insert(1);
+        }
+        catch(const std::logic_error&)
+        {
+                threw = true;
+        }
+        std::cout << "Bounded spilled over, size " << bag.size() << (threw ? ", threw when full" : ", accepted when full") << '\n';
+}
+
+// A child process inserts into a bag in a memfd while the parent extracts, then the parent reattaches to whatever is left
+void shared_test()
+{
+        const int fd = memfd_create("wait_free_bag", 0);
+        if(fd < 0) return;
+
+        long sum = 0;
+        {
+                wait_free_bag::SharedBag<long, 4> bag(fd, 256);
+                bag.insert(1000);
+
+                const pid_t child = fork();
+                if(child == 0)
+                {
+                        wait_free_bag::SharedBag<long, 4> child_bag(fd, 256);
+                        for(long i = 0; i < 100; i++) child_bag.insert(i);
+                        _exit(0);
+                }
+                for(int i = 0; i < 50; i++)
+                {
+                        if(const std::optional<long> element = bag.extract()) sum += *element;
+                }
+                waitpid(child, nullptr, 0);
+        }
+
+        wait_free_bag::SharedBag<long, 4> bag(fd, 256);
+        const std::size_t                 left = bag.size();
+        while(const std::optional<long> element = bag.extract()) sum += *element;
+        std::cout << "Shared sum " << sum << ", " << (left > 0 ? "found elements after reattach" : "drained before reattach") << '\n';
+        close(fd);
+}
+
+// Coroutine that runs eagerly and cleans up after itself
+struct detached_t
+{
+        public:
+                struct promise_type
+                {
+                        public:
+                                detached_t get_return_object()
+                                {
+                                        return {};
+                                }
+
+                                std::suspend_never initial_suspend()
+                                {
+                                        return {};
+                                }
+
+                                std::suspend_never final_suspend() noexcept
+                                {
+                                        return {};
+                                }
+
+                                void return_void() {}
+
+                                void unhandled_exception()
+                                {
+                                        std::terminate();
+                                }
+                };
+};
+
+detached_t await_test(auto& bag)
+{
+        const int value = co_await bag.extract_async();
+        std::cout << "Awaited " << value << '\n';
+}
+
+void blocking_test(auto& bag)
+{
+        // The bag is empty, so the coroutine parks and the insert resumes it
+        await_test(bag);
+        bag.insert(42);
+
+        std::cout << (bag.extract_for(std::chrono::milliseconds(10)) ? "Unexpected element" : "Timed out") << '\n';
+
+	#pragma omp parallel sections
+        {
+	        #pragma omp section
+                bag.insert(7);
+	        #pragma omp section
+                std::osyncstream(std::cout) << "Waited for " << bag.extract_wait() << '\n';
+        }
+}
+
+void run_tests(auto& bag)
+{
         insert_test(bag);
         std::cout << "=========== Insert Done =============" << std::endl;
         size_test(bag);
         std::cout << "===========  Size  Done =============" << std::endl;
         for_all_test(bag);
         std::cout << "=========== ForAll Done =============" << std::endl;
+        traversal_test(bag);
+        std::cout << "========= Traversal Done ============" << std::endl;
         extract_test(bag);
         std::cout << "=========== Extract Done =============" << std::endl;
         size_test(bag);
         std::cout << "===========  Size  Done =============" << std::endl;
         for_all_test(bag);
         std::cout << "=========== ForAll Done =============" << std::endl;
+        blocking_test(bag);
+        std::cout << "========== Blocking Done ============" << std::endl;
+        stats_test(bag);
+        std::cout << "===========  Stats Done =============" << std::endl;
+}
+
+static_assert(std::ranges::forward_range<wait_free_bag::WaitFreeBag<int, 16>>);
+static_assert(std::ranges::forward_range<const wait_free_bag::WaitFreeBag<int, 16, wait_free_bag::SegmentedQueue<int, 8>>>);
+static_assert(std::ranges::forward_range<wait_free_bag::WaitFreeBag<int, 64, wait_free_bag::WorkStealingDeque<int>>>);
+static_assert(std::ranges::forward_range<wait_free_bag::WaitFreeBag<int, 16, wait_free_bag::HelpingQueue<int>>>);
+static_assert(std::ranges::forward_range<const wait_free_bag::WaitFreeBag<int, 16, wait_free_bag::BoundedRing<int>>>);
+static_assert(std::ranges::forward_range<wait_free_bag::WaitFreeBag<int, 16, wait_free_bag::TreiberStack<int>>>);
+
+int main()
+{
+        wait_free_bag::WaitFreeBag<int, 16> bag;
+        run_tests(bag);
+
+        wait_free_bag::WaitFreeBag<int, 16, wait_free_bag::SegmentedQueue<int, 8>> segmented_bag;
+        run_tests(segmented_bag);
+
+        wait_free_bag::WaitFreeBag<int, 64, wait_free_bag::WorkStealingDeque<int>> work_stealing_bag;
+        run_tests(work_stealing_bag);
+
+        wait_free_bag::WaitFreeBag<int, 16> adaptive_bag(4, true);
+        run_tests(adaptive_bag);
+
+        wait_free_bag::WaitFreeBag<int, 16, wait_free_bag::HelpingQueue<int>> helping_bag;
+        run_tests(helping_bag);
+
+        wait_free_bag::WaitFreeBag<int, 16, wait_free_bag::BoundedRing<int, 256>> ring_bag;
+        run_tests(ring_bag);
+        range_traversal_test();
+        throwing_executor_test();
+        ring_traversal_test();
+        bounded_test();
+        bounded_spill_test();
+        overflow_test();
+        shared_test();
+
+        wait_free_bag::WaitFreeBag<int, 16, wait_free_bag::TreiberStack<int>> stack_bag;
+        run_tests(stack_bag);
+
+        move_only_test<wait_free_bag::WaitFreeBag<std::unique_ptr<int>, 4>>();
+        move_only_test<wait_free_bag::WaitFreeBag<std::unique_ptr<int>, 4, wait_free_bag::SegmentedQueue<std::unique_ptr<int>, 8>>>();
+        move_only_test<wait_free_bag::WaitFreeBag<std::unique_ptr<int>, 4, wait_free_bag::HelpingQueue<std::unique_ptr<int>>>>();
+        move_only_test<wait_free_bag::WaitFreeBag<std::unique_ptr<int>, 4, wait_free_bag::BoundedRing<std::unique_ptr<int>, 8>>>();
+        move_only_test<wait_free_bag::WaitFreeBag<std::unique_ptr<int>, 4, wait_free_bag::TreiberStack<std::unique_ptr<int>>>>();
+
+        throwing_range_test<wait_free_bag::WaitFreeBag<fragile_t, 4>>();
+        throwing_range_test<wait_free_bag::WaitFreeBag<fragile_t, 4, wait_free_bag::TreiberStack<fragile_t>>>();
 }
@@ -29,7 +29,7 @@ void wait_free_extract(auto& bag)
         #pragma omp parallel for
         for(std::size_t i = 0; i < THREADS; i++)
         {
-                while(bag.size() > 0) bag.extract();
+                while(bag.size_approx() > 0) bag.extract();
         }
 }
 